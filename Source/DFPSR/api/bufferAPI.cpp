@@ -23,9 +23,15 @@
 
 #include <fstream>
 #include <cstdlib>
+#include <mutex>
+#include <atomic>
 #include "bufferAPI.h"
 #include "stringAPI.h"
 #include "../math/scalar.h"
+#include "../collection/List.h"
+#if defined(__linux__)
+	#include <sys/mman.h>
+#endif
 
 namespace dsr {
 
@@ -54,35 +60,160 @@ public:
 
 // Internal methods
 
-// buffer_alignment must be a power of two for buffer_alignment_mask to work
-static const int buffer_alignment = 16;
+// Small buffers such as strings only need alignment for 128-bit SIMD vectors
+static const int64_t buffer_alignment = 16;
+// Larger buffers are aligned to whole cache lines, so that no two threads working on different rows share a cache line at the start
+static const int64_t buffer_cacheLineThreshold = 1024;
+static const int64_t buffer_cacheLineAlignment = 64;
+// Pooled buffers are aligned to whole pages
+static const int64_t buffer_pageAlignment = 4096;
+// Buffers using transparent huge pages are aligned to the huge page size, so that the whole allocation can be covered by huge pages
+static const int64_t buffer_hugePageAlignment = 2097152;
+
+// Alignment must be a power of two
+static inline int64_t buffer_roundUp(int64_t size, int64_t alignment) {
+	return (size + (alignment - 1)) & ~(alignment - 1);
+}
 
-// If this C++ version additionally includes the C11 features then we may assume that aligned_alloc is available
+// The allocation policy is read without locking when creating buffers
+static std::atomic<int64_t> policyPoolThreshold(BufferAllocationPolicy().poolThreshold);
+static std::atomic<int64_t> policyPoolLimit(BufferAllocationPolicy().poolLimit);
+static std::atomic<int64_t> policyHugePageThreshold(BufferAllocationPolicy().hugePageThreshold);
+
+// Allocate data of newSize with the given alignment and write the corresponding free function to targetFree
 #ifdef _ISOC11_SOURCE
-	// Allocate data of newSize and write the corresponding destructor function to targetDestructor
-	static uint8_t* buffer_allocate(int64_t newSize, std::function<void(uint8_t *)>& targetDestructor) {
-		uint8_t* allocation = (uint8_t*)aligned_alloc(buffer_alignment, newSize);
-		targetDestructor = [](uint8_t *data) { free(data); };
+	// If this C++ version additionally includes the C11 features then we may assume that aligned_alloc is available
+	static uint8_t* buffer_allocateAligned(int64_t newSize, int64_t alignment, std::function<void(uint8_t *)>& targetFree) {
+		// aligned_alloc requires the size to be a multiple of the alignment
+		uint8_t* allocation = (uint8_t*)aligned_alloc(alignment, buffer_roundUp(newSize, alignment));
+		targetFree = [](uint8_t *data) { free(data); };
 		return allocation;
 	}
 #else
-	static const uintptr_t buffer_alignment_mask = ~((uintptr_t)(buffer_alignment - 1));
-	// Allocate data of newSize and write the corresponding destructor function to targetDestructor
-	static uint8_t* buffer_allocate(int64_t newSize, std::function<void(uint8_t *)>& targetDestructor) {
-		uintptr_t padding = buffer_alignment - 1;
+	static uint8_t* buffer_allocateAligned(int64_t newSize, int64_t alignment, std::function<void(uint8_t *)>& targetFree) {
+		uintptr_t padding = alignment - 1;
 		uint8_t* allocation = (uint8_t*)malloc(newSize + padding);
-		uint8_t* aligned = (uint8_t*)(((uintptr_t)allocation + padding) & buffer_alignment_mask);
-		uintptr_t offset = allocation - aligned;
-		targetDestructor = [offset](uint8_t *data) { free(data - offset); };
+		if (allocation == nullptr) {
+			return nullptr;
+		}
+		uint8_t* aligned = (uint8_t*)(((uintptr_t)allocation + padding) & ~((uintptr_t)padding));
+		uintptr_t offset = aligned - allocation;
+		targetFree = [offset](uint8_t *data) { free(data - offset); };
 		return aligned;
 	}
 #endif
 
+// A released allocation waiting to be reused by a buffer of the same size
+struct PooledAllocation {
+	uint8_t *data;
+	int64_t size;
+	std::function<void(uint8_t *)> freeAllocation;
+};
+
+struct BufferPool {
+	std::mutex lock;
+	// Allocations in the order they were released, so that the oldest can be freed first when the pool is full
+	List<PooledAllocation> allocations;
+	int64_t pooledBytes = 0;
+	// Pre-condition: lock is owned by the caller
+	void releaseOldest() {
+		PooledAllocation &oldest = this->allocations[0];
+		oldest.freeAllocation(oldest.data);
+		this->pooledBytes -= oldest.size;
+		this->allocations.remove(0);
+	}
+	void releaseAbove(int64_t limit) {
+		std::unique_lock<std::mutex> lock(this->lock);
+		while (this->pooledBytes > limit && this->allocations.length() > 0) {
+			this->releaseOldest();
+		}
+	}
+	~BufferPool();
+};
+
+// Buffers may be released by other global destructors after the pool is gone, so they must then be freed directly
+static bool poolClosed = false;
+
+BufferPool::~BufferPool() {
+	this->releaseAbove(0);
+	poolClosed = true;
+}
+
+// Constructed on first use, so that buffers can be created from other global constructors
+static BufferPool& getBufferPool() {
+	static BufferPool pool;
+	return pool;
+}
+
+// Take an allocation of exactly size bytes from the pool, or return nullptr if none is available
+static uint8_t* buffer_takeFromPool(int64_t size, std::function<void(uint8_t *)>& targetFree) {
+	BufferPool &bufferPool = getBufferPool();
+	std::unique_lock<std::mutex> lock(bufferPool.lock);
+	// Search from the most recently released, which is most likely to still be in the cache
+	for (int64_t a = bufferPool.allocations.length() - 1; a >= 0; a--) {
+		if (bufferPool.allocations[a].size == size) {
+			uint8_t *result = bufferPool.allocations[a].data;
+			targetFree = bufferPool.allocations[a].freeAllocation;
+			bufferPool.allocations.remove(a);
+			bufferPool.pooledBytes -= size;
+			return result;
+		}
+	}
+	return nullptr;
+}
+
+// Give an allocation back to the pool, or free it if it cannot be kept
+static void buffer_returnToPool(uint8_t *data, int64_t size, const std::function<void(uint8_t *)>& freeAllocation) {
+	int64_t limit = policyPoolLimit.load(std::memory_order_relaxed);
+	if (poolClosed || size > limit) {
+		freeAllocation(data);
+		return;
+	}
+	BufferPool &bufferPool = getBufferPool();
+	std::unique_lock<std::mutex> lock(bufferPool.lock);
+	// Free the oldest allocations until there is room for the new one
+	while (bufferPool.pooledBytes + size > limit && bufferPool.allocations.length() > 0) {
+		bufferPool.releaseOldest();
+	}
+	bufferPool.allocations.push(PooledAllocation{data, size, freeAllocation});
+	bufferPool.pooledBytes += size;
+}
+
+// Allocate data of newSize and write the corresponding destructor function to targetDestructor
+static uint8_t* buffer_allocate(int64_t newSize, std::function<void(uint8_t *)>& targetDestructor) {
+	if (newSize < buffer_cacheLineThreshold) {
+		return buffer_allocateAligned(newSize, buffer_alignment, targetDestructor);
+	} else if (newSize < policyPoolThreshold.load(std::memory_order_relaxed)) {
+		return buffer_allocateAligned(newSize, buffer_cacheLineAlignment, targetDestructor);
+	} else {
+		int64_t hugePageThreshold = policyHugePageThreshold.load(std::memory_order_relaxed);
+		bool hugePages = hugePageThreshold > 0 && newSize >= hugePageThreshold;
+		// Round up to whole pages, so that buffers of almost the same size can share pooled allocations
+		int64_t allocationSize = buffer_roundUp(newSize, hugePages ? buffer_hugePageAlignment : buffer_pageAlignment);
+		std::function<void(uint8_t *)> freeAllocation;
+		uint8_t* allocation = buffer_takeFromPool(allocationSize, freeAllocation);
+		if (allocation == nullptr) {
+			allocation = buffer_allocateAligned(allocationSize, hugePages ? buffer_hugePageAlignment : buffer_pageAlignment, freeAllocation);
+			if (allocation == nullptr) {
+				return nullptr;
+			}
+			#if defined(__linux__) && defined(MADV_HUGEPAGE)
+				if (hugePages) {
+					// Only advise, so failure just means that regular pages are used
+					madvise(allocation, allocationSize, MADV_HUGEPAGE);
+				}
+			#endif
+		}
+		targetDestructor = [allocationSize, freeAllocation](uint8_t *data) { buffer_returnToPool(data, allocationSize, freeAllocation); };
+		return allocation;
+	}
+}
+
 BufferImpl::BufferImpl() : size(0), bufferSize(0), data(nullptr) {}
 
 BufferImpl::BufferImpl(int64_t newSize) :
   size(newSize),
-  bufferSize(roundUp(newSize, buffer_alignment)) {
+  bufferSize(buffer_roundUp(newSize, buffer_alignment)) {
 	this->data = buffer_allocate(this->bufferSize, this->destructor);
 	if (this->data == nullptr) {
 		throwError(U"Failed to allocate buffer of ", newSize, " bytes!\n");
@@ -166,6 +297,32 @@ uint8_t* buffer_dangerous_getUnsafeData(const Buffer &buffer) {
 	}
 }
 
+void buffer_setAllocationPolicy(const BufferAllocationPolicy &policy) {
+	policyPoolThreshold.store(policy.poolThreshold, std::memory_order_relaxed);
+	policyPoolLimit.store(policy.poolLimit, std::memory_order_relaxed);
+	policyHugePageThreshold.store(policy.hugePageThreshold, std::memory_order_relaxed);
+	// Free any pooled allocations that no longer fit within the limit
+	getBufferPool().releaseAbove(policy.poolLimit);
+}
+
+BufferAllocationPolicy buffer_getAllocationPolicy() {
+	BufferAllocationPolicy result;
+	result.poolThreshold = policyPoolThreshold.load(std::memory_order_relaxed);
+	result.poolLimit = policyPoolLimit.load(std::memory_order_relaxed);
+	result.hugePageThreshold = policyHugePageThreshold.load(std::memory_order_relaxed);
+	return result;
+}
+
+int64_t buffer_getPooledBytes() {
+	BufferPool &bufferPool = getBufferPool();
+	std::unique_lock<std::mutex> lock(bufferPool.lock);
+	return bufferPool.pooledBytes;
+}
+
+void buffer_releasePool() {
+	getBufferPool().releaseAbove(0);
+}
+
 void buffer_setBytes(const Buffer &buffer, uint8_t value) {
 	if (!buffer_exists(buffer)) {
 		throwError(U"buffer_setBytes: Cannot set bytes for a buffer that don't exist.\n");
@@ -106,6 +106,32 @@ namespace dsr {
 		}
 	}
 
+	// Decides how buffer_create allocates memory for large buffers.
+	//   Buffers of at least 1024 bytes are always aligned to 64-byte cache lines.
+	struct BufferAllocationPolicy {
+		// Buffers of at least poolThreshold bytes are aligned to whole pages and kept for reuse after being released.
+		//   Creating a buffer of the same size rounded up to whole pages will then reuse the memory without page faults.
+		int64_t poolThreshold = 262144;
+		// The maximum number of bytes to keep in released buffers, freeing the oldest first when full.
+		//   Set to zero to disable pooling.
+		int64_t poolLimit = 268435456;
+		// Pooled buffers of at least hugePageThreshold bytes are aligned to 2 MiB and advised to use transparent huge pages where supported.
+		//   Set to zero to disable huge pages.
+		int64_t hugePageThreshold = 4194304;
+	};
+
+	// Side-effect: Sets the allocation policy for buffers created after the call, and frees pooled memory above the new limit.
+	void buffer_setAllocationPolicy(const BufferAllocationPolicy &policy);
+
+	// Post-condition: Returns the current allocation policy.
+	BufferAllocationPolicy buffer_getAllocationPolicy();
+
+	// Post-condition: Returns the number of bytes currently kept in released buffers waiting to be reused.
+	int64_t buffer_getPooledBytes();
+
+	// Side-effect: Frees all released buffers kept for reuse, such as after loading a level with a different resolution.
+	void buffer_releasePool();
+
 	// Set all bytes to the same value.
 	// Pre-condition: buffer exists, or else an exception is thrown to warn you.
 	//   If the buffer has a head but no data allocation, the command will be ignored because there are no bytes to set.
@@ -37,6 +37,8 @@
 	#include <sys/wait.h>
 	#include <sys/stat.h>
 	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
 	// The environment flags contain information such as username, language, color settings, which system shell and window manager is used...
 	extern char **environ;
 #endif
@@ -129,6 +131,72 @@ Buffer file_loadBuffer(const ReadableString& filename, bool mustExist) {
 	}
 }
 
+Buffer file_mapBuffer(const ReadableString& filename, bool mustExist) {
+	String modifiedFilename = file_optimizePath(filename, LOCAL_PATH_SYNTAX);
+	Buffer nameBuffer;
+	const NativeChar *nativeName = toNativeString(modifiedFilename, nameBuffer);
+	#ifdef USE_MICROSOFT_WINDOWS
+		HANDLE file = CreateFileW(nativeName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file != INVALID_HANDLE_VALUE) {
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize)) {
+				CloseHandle(file);
+				return file_loadBuffer(filename, mustExist);
+			} else if (fileSize.QuadPart == 0) {
+				// Mapping an empty file is not allowed, so return an empty buffer head like file_loadBuffer
+				CloseHandle(file);
+				return buffer_create(0);
+			}
+			// Copy on write, so that accidental writes can not reach the file
+			HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			uint8_t *data = nullptr;
+			if (mapping != nullptr) {
+				data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+				// The view keeps the mapping alive after the handles are closed
+				CloseHandle(mapping);
+			}
+			CloseHandle(file);
+			if (data == nullptr) {
+				return file_loadBuffer(filename, mustExist);
+			}
+			Buffer result = buffer_create(fileSize.QuadPart, data);
+			buffer_replaceDestructor(result, [](uint8_t *data) { UnmapViewOfFile(data); });
+			return result;
+		}
+	#else
+		int file = open(nativeName, O_RDONLY);
+		if (file != -1) {
+			struct stat fileStatus;
+			if (fstat(file, &fileStatus) != 0 || !S_ISREG(fileStatus.st_mode)) {
+				// Pipes and devices can not be mapped, so let the stream reader handle them
+				close(file);
+				return file_loadBuffer(filename, mustExist);
+			}
+			int64_t fileSize = fileStatus.st_size;
+			if (fileSize == 0) {
+				// Mapping an empty file is not allowed, so return an empty buffer head like file_loadBuffer
+				close(file);
+				return buffer_create(0);
+			}
+			// A private mapping can be written to without reaching the file, because touched pages are copied on write
+			void *data = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+			// The mapping keeps the file open after closing the descriptor
+			close(file);
+			if (data == MAP_FAILED) {
+				return file_loadBuffer(filename, mustExist);
+			}
+			Buffer result = buffer_create(fileSize, (uint8_t*)data);
+			buffer_replaceDestructor(result, [fileSize](uint8_t *data) { munmap((void*)data, fileSize); });
+			return result;
+		}
+	#endif
+	if (mustExist) {
+		throwError(U"Failed to map ", modifiedFilename, ".\n");
+	}
+	// If the file cound not be found and opened, an empty buffer is returned
+	return Buffer();
+}
+
 bool file_saveBuffer(const ReadableString& filename, Buffer buffer, bool mustWork) {
 	String modifiedFilename = file_optimizePath(filename, LOCAL_PATH_SYNTAX);
 	if (!buffer_exists(buffer)) {
@@ -62,6 +62,23 @@ namespace dsr {
 	//   If mustExist is false, then failure to load will return an empty handle (returning false for buffer_exists).
 	Buffer file_loadBuffer(const ReadableString& filename, bool mustExist = true);
 
+	// Path-syntax: According to the local computer.
+	// Post-condition:
+	//   Returns the content of the readable file referred to by file_optimizePath(filename), just like file_loadBuffer.
+	//   Instead of copying the file into a new allocation, the buffer maps the file directly into memory.
+	//   Pages are only read from the operating system's file cache when touched, which saves time and memory for large files that are only decoded once.
+	//   The buffer should be treated as read-only, because writing to it will not modify the file. Each written page is only copied for this buffer.
+	//   The mapping is released by the buffer's destructor when the last handle is gone.
+	//   Falls back on file_loadBuffer for files that cannot be mapped.
+	//   Only use it for files that no other process may truncate while mapped, because reading a page beyond the new end of the file
+	//     raises SIGBUS and terminates the program, while file_loadBuffer fails gracefully.
+	//     Assets that are edited and hot-reloaded while running should therefore use file_loadBuffer.
+	//   Small files are faster to load with file_loadBuffer, because mapping, unmapping and page faults cost more than copying a few pages.
+	//   string_load and image_load_RgbaU8 use file_loadBuffer, so decode a mapped buffer using string_loadFromMemory or image_decode_RgbaU8 to opt in.
+	//   If mustExist is true, then failure to load will throw an exception.
+	//   If mustExist is false, then failure to load will return an empty handle (returning false for buffer_exists).
+	Buffer file_mapBuffer(const ReadableString& filename, bool mustExist = true);
+
 	// Path-syntax: According to the local computer.
 	// Side-effect: Saves buffer to file_optimizePath(filename) as a binary file.
 	// Pre-condition: buffer exists.
@@ -33,6 +33,7 @@
 #include "../image/internal/imageInternal.h"
 #include "../image/stbImage/stbImageWrapper.h"
 #include "../math/scalar.h"
+#include "../base/threading.h"
 
 using namespace dsr;
 
@@ -711,26 +712,31 @@ ELEMENT_TYPE maxDifference_template(const IMAGE_TYPE& imageA, const IMAGE_TYPE&
 	if (imageA.width != imageB.width || imageA.height != imageB.height) {
 		return std::numeric_limits<ELEMENT_TYPE>::max();
 	} else {
-		ELEMENT_TYPE maxDifference = 0;
-		const SafePointer<ELEMENT_TYPE> rowDataA = imageInternal::getSafeData<ELEMENT_TYPE>(imageA);
-		const SafePointer<ELEMENT_TYPE> rowDataB = imageInternal::getSafeData<ELEMENT_TYPE>(imageB);
-		for (int y = 0; y < imageA.height; y++) {
-			const SafePointer<ELEMENT_TYPE> pixelDataA = rowDataA;
-			const SafePointer<ELEMENT_TYPE> pixelDataB = rowDataB;
-			for (int x = 0; x < imageA.width; x++) {
-				for (int c = 0; c < CHANNELS; c++) {
-					ELEMENT_TYPE difference = absDiff(*pixelDataA, *pixelDataB);
-					if (difference > maxDifference) {
-						maxDifference = difference;
+		// Each thread finds the largest difference in its own rows
+		return threadedReduce<ELEMENT_TYPE>(0, imageA.height, 0, [&imageA, &imageB](int startRow, int stopRow) {
+			ELEMENT_TYPE maxDifference = 0;
+			const SafePointer<ELEMENT_TYPE> rowDataA = imageInternal::getSafeData<ELEMENT_TYPE>(imageA, startRow);
+			const SafePointer<ELEMENT_TYPE> rowDataB = imageInternal::getSafeData<ELEMENT_TYPE>(imageB, startRow);
+			for (int y = startRow; y < stopRow; y++) {
+				const SafePointer<ELEMENT_TYPE> pixelDataA = rowDataA;
+				const SafePointer<ELEMENT_TYPE> pixelDataB = rowDataB;
+				for (int x = 0; x < imageA.width; x++) {
+					for (int c = 0; c < CHANNELS; c++) {
+						ELEMENT_TYPE difference = absDiff(*pixelDataA, *pixelDataB);
+						if (difference > maxDifference) {
+							maxDifference = difference;
+						}
+						pixelDataA += 1;
+						pixelDataB += 1;
 					}
-					pixelDataA += 1;
-					pixelDataB += 1;
 				}
+				rowDataA.increaseBytes(imageA.stride);
+				rowDataB.increaseBytes(imageB.stride);
 			}
-			rowDataA.increaseBytes(imageA.stride);
-			rowDataB.increaseBytes(imageB.stride);
-		}
-		return maxDifference;
+			return maxDifference;
+		}, [](ELEMENT_TYPE a, ELEMENT_TYPE b) {
+			return a > b ? a : b;
+		});
 	}
 }
 uint8_t dsr::image_maxDifference(const ImageU8& imageA, const ImageU8& imageB) {
@@ -26,8 +26,12 @@
 #include "modelAPI.h"
 #include "imageAPI.h"
 #include "drawAPI.h"
+#include "filterAPI.h"
+#include "timeAPI.h"
+#include "../image/draw.h"
 #include "../render/model/Model.h"
 #include <limits>
+#include <cmath>
 
 #define MUST_EXIST(OBJECT, METHOD) if (OBJECT.get() == nullptr) { throwError("The " #OBJECT " handle was null in " #METHOD "\n"); }
 
@@ -194,12 +198,22 @@ void model_setLightMapByName(Model& model, int partIndex, ResourcePool &pool, co
 // Single-threaded rendering for the simple cases where you just want it to work
 void model_render(const Model& model, const Transform3D &modelToWorldTransform, ImageRgbaU8& colorBuffer, ImageF32& depthBuffer, const Camera &camera) {
 	if (model.get() != nullptr) {
-		model->render((CommandQueue*)nullptr, colorBuffer, depthBuffer, modelToWorldTransform, camera);
+		model->render((CommandQueue*)nullptr, colorBuffer, depthBuffer.get(), modelToWorldTransform, camera);
+	}
+}
+void model_render(const Model& model, const Transform3D &modelToWorldTransform, ImageRgbaU8& colorBuffer, ImageU16& depthBuffer, const Camera &camera) {
+	if (model.get() != nullptr) {
+		model->render((CommandQueue*)nullptr, colorBuffer, DepthTarget(depthBuffer.get(), camera), modelToWorldTransform, camera);
 	}
 }
 void model_renderDepth(const Model& model, const Transform3D &modelToWorldTransform, ImageF32& depthBuffer, const Camera &camera) {
 	if (model.get() != nullptr) {
-		model->renderDepth(depthBuffer, modelToWorldTransform, camera);
+		model->renderDepth(depthBuffer.get(), modelToWorldTransform, camera);
+	}
+}
+void model_renderDepth(const Model& model, const Transform3D &modelToWorldTransform, ImageU16& depthBuffer, const Camera &camera) {
+	if (model.get() != nullptr) {
+		model->renderDepth(DepthTarget(depthBuffer.get(), camera), modelToWorldTransform, camera);
 	}
 }
 
@@ -223,30 +237,286 @@ struct RendererImpl {
 	bool receiving = false; // Preventing version dependency by only allowing calls in the expected order
 	ImageRgbaU8 colorBuffer; // The color image being rendered to
 	ImageF32 depthBuffer; // Linear depth for isometric cameras, 1 / depth for perspective cameras
+	ImageU16 quantizedDepthBuffer; // Used instead of depthBuffer for 16-bit depth, quantized using the depth range of each camera
+	// When multisampling, colorBuffer and the depth buffers refer to sample images with 2x2 samples per pixel,
+	//   which are resolved into the images given to renderer_begin when the frame ends.
+	bool multisampling = false;
+	ImageRgbaU8 resolvedColorBuffer, sampleColorBuffer;
+	ImageF32 resolvedDepthBuffer, sampleDepthBuffer;
+	ImageU16 resolvedQuantizedDepthBuffer, sampleQuantizedDepthBuffer;
+	// When dynamicResolution is enabled, each frame is rendered into scaled images of resolutionScale times the size of the images given to renderer_begin,
+	//   which are upscaled into the given images when the frame ends.
+	//   Before multisampling, so that colorBuffer and the depth buffers refer to the scaled images or to their samples.
+	bool dynamicResolution = false;
+	double targetFrameSeconds = 0.0;
+	float minimumResolutionScale = 1.0f;
+	float resolutionScale = 1.0f;
+	Sampler upscaleSampler = Sampler::Linear;
+	bool scaledFrame = false; // True when the current frame is rendered into the scaled images
+	double frameStartTime = 0.0;
+	int presentWidth = 0, presentHeight = 0; // The dimensions of the images given to renderer_begin
+	ImageRgbaU8 presentColorBuffer, scaledColorBuffer;
+	ImageF32 presentDepthBuffer, scaledDepthBuffer;
+	ImageU16 presentQuantizedDepthBuffer, scaledQuantizedDepthBuffer;
+	// Counts and timings for the current or last frame, collected when collectingStatistics is true
+	bool collectingStatistics = false;
+	RenderStatistics statistics;
 	ImageF32 depthGrid; // An occlusion grid of cellSize² cells representing the longest linear depth where something might be visible
-	CommandQueue commandQueue; // Triangles to be drawn
+	CommandQueue commandQueue; // Triangles to be drawn, including those from partition 0
+	// Command queues for partitions 1 and up, so that each thread giving tasks has its own queue without locking
+	//   Kept between frames so that their memory is reused, and appended to commandQueue in the order of partitions before drawing.
+	List<CommandQueue> partitionQueues;
+	List<RenderStatistics> partitionStatistics;
 	List<DebugLine> debugLines; // Additional lines to be drawn as an overlay for debugging occlusion
 	int width = 0, height = 0, gridWidth = 0, gridHeight = 0;
 	bool occluded = false;
 	RendererImpl() {}
-	void beginFrame(ImageRgbaU8& colorBuffer, ImageF32& depthBuffer) {
+	// At most one of depthBuffer and quantizedDepthBuffer may exist.
+	void beginFrame(const ImageRgbaU8& colorBuffer, const ImageF32& depthBuffer, const ImageU16& quantizedDepthBuffer) {
 		if (this->receiving) {
 			throwError("Called renderer_begin on the same renderer twice without ending the previous batch!\n");
 		}
 		this->receiving = true;
+		this->statistics = RenderStatistics();
+		this->commandQueue.statistics = this->collectingStatistics ? &(this->statistics) : nullptr;
+		for (int p = 0; p < this->partitionQueues.length(); p++) {
+			this->partitionStatistics[p] = RenderStatistics();
+			this->partitionQueues[p].statistics = this->collectingStatistics ? &(this->partitionStatistics[p]) : nullptr;
+		}
 		this->colorBuffer = colorBuffer;
 		this->depthBuffer = depthBuffer;
+		this->quantizedDepthBuffer = quantizedDepthBuffer;
 		if (image_exists(this->colorBuffer)) {
 			this->width = image_getWidth(this->colorBuffer);
 			this->height = image_getHeight(this->colorBuffer);
 		} else if (image_exists(this->depthBuffer)) {
 			this->width = image_getWidth(this->depthBuffer);
 			this->height = image_getHeight(this->depthBuffer);
+		} else if (image_exists(this->quantizedDepthBuffer)) {
+			this->width = image_getWidth(this->quantizedDepthBuffer);
+			this->height = image_getHeight(this->quantizedDepthBuffer);
+		}
+		this->presentWidth = this->width;
+		this->presentHeight = this->height;
+		this->scaledFrame = false;
+		if (this->dynamicResolution) {
+			this->frameStartTime = time_getSeconds();
+			int scaledWidth = std::max(1, (int)(this->width * this->resolutionScale + 0.5f));
+			int scaledHeight = std::max(1, (int)(this->height * this->resolutionScale + 0.5f));
+			if (scaledWidth < this->width || scaledHeight < this->height) {
+				this->beginScaledFrame(scaledWidth, scaledHeight);
+			}
+		}
+		if (this->multisampling) {
+			// Render into sample images starting with the content of the given or scaled images
+			ImageRgbaU8 colorBuffer = this->colorBuffer;
+			ImageF32 depthBuffer = this->depthBuffer;
+			ImageU16 quantizedDepthBuffer = this->quantizedDepthBuffer;
+			this->resolvedColorBuffer = colorBuffer;
+			this->resolvedDepthBuffer = depthBuffer;
+			this->resolvedQuantizedDepthBuffer = quantizedDepthBuffer;
+			this->width *= 2;
+			this->height *= 2;
+			if (image_exists(colorBuffer)) {
+				// The samples use the same pack order as the target, so that resolving does not have to reorder channels
+				PackOrderIndex packOrder = image_getPackOrderIndex(colorBuffer);
+				if (!(image_exists(this->sampleColorBuffer) && image_getWidth(this->sampleColorBuffer) == this->width && image_getHeight(this->sampleColorBuffer) == this->height
+				  && image_getPackOrderIndex(this->sampleColorBuffer) == packOrder)) {
+					this->sampleColorBuffer = image_create_RgbaU8_native(this->width, this->height, packOrder);
+				}
+				this->colorBuffer = this->sampleColorBuffer;
+			}
+			if (image_exists(depthBuffer)) {
+				if (!(image_exists(this->sampleDepthBuffer) && image_getWidth(this->sampleDepthBuffer) == this->width && image_getHeight(this->sampleDepthBuffer) == this->height)) {
+					this->sampleDepthBuffer = image_create_F32(this->width, this->height);
+				}
+				this->depthBuffer = this->sampleDepthBuffer;
+			}
+			if (image_exists(quantizedDepthBuffer)) {
+				if (!(image_exists(this->sampleQuantizedDepthBuffer) && image_getWidth(this->sampleQuantizedDepthBuffer) == this->width && image_getHeight(this->sampleQuantizedDepthBuffer) == this->height)) {
+					this->sampleQuantizedDepthBuffer = image_create_U16(this->width, this->height);
+				}
+				this->quantizedDepthBuffer = this->sampleQuantizedDepthBuffer;
+			}
+			expandSamples(this->colorBuffer.get(), this->depthBuffer.get(), colorBuffer.get(), depthBuffer.get());
+			expandSamples(nullptr, this->quantizedDepthBuffer.get(), nullptr, quantizedDepthBuffer.get());
 		}
 		this->gridWidth = (this->width + (cellSize - 1)) / cellSize;
 		this->gridHeight = (this->height + (cellSize - 1)) / cellSize;
 		this->occluded = false;
 	}
+	// Replaces the images given to renderer_begin with scaled images of scaledWidth x scaledHeight pixels, starting with a nearest neighbor copy of their content
+	void beginScaledFrame(int scaledWidth, int scaledHeight) {
+		this->scaledFrame = true;
+		this->presentColorBuffer = this->colorBuffer;
+		this->presentDepthBuffer = this->depthBuffer;
+		this->presentQuantizedDepthBuffer = this->quantizedDepthBuffer;
+		this->width = scaledWidth;
+		this->height = scaledHeight;
+		if (image_exists(this->presentColorBuffer)) {
+			// The same pack order as the target, so that upscaling does not have to reorder channels
+			PackOrderIndex packOrder = image_getPackOrderIndex(this->presentColorBuffer);
+			if (!(image_exists(this->scaledColorBuffer) && image_getWidth(this->scaledColorBuffer) == scaledWidth && image_getHeight(this->scaledColorBuffer) == scaledHeight
+			  && image_getPackOrderIndex(this->scaledColorBuffer) == packOrder)) {
+				this->scaledColorBuffer = image_create_RgbaU8_native(scaledWidth, scaledHeight, packOrder);
+			}
+			imageImpl_resizeToTarget(*(this->scaledColorBuffer.get()), *(this->presentColorBuffer.get()), false);
+			this->colorBuffer = this->scaledColorBuffer;
+		}
+		if (image_exists(this->presentDepthBuffer)) {
+			if (!(image_exists(this->scaledDepthBuffer) && image_getWidth(this->scaledDepthBuffer) == scaledWidth && image_getHeight(this->scaledDepthBuffer) == scaledHeight)) {
+				this->scaledDepthBuffer = image_create_F32(scaledWidth, scaledHeight);
+			}
+			this->depthBuffer = this->scaledDepthBuffer;
+		}
+		if (image_exists(this->presentQuantizedDepthBuffer)) {
+			if (!(image_exists(this->scaledQuantizedDepthBuffer) && image_getWidth(this->scaledQuantizedDepthBuffer) == scaledWidth && image_getHeight(this->scaledQuantizedDepthBuffer) == scaledHeight)) {
+				this->scaledQuantizedDepthBuffer = image_create_U16(scaledWidth, scaledHeight);
+			}
+			this->quantizedDepthBuffer = this->scaledQuantizedDepthBuffer;
+		}
+		resampleDepth(this->depthBuffer.get(), this->presentDepthBuffer.get());
+		resampleDepth(this->quantizedDepthBuffer.get(), this->presentQuantizedDepthBuffer.get());
+	}
+	// Upscales the scaled images into the images given to renderer_begin
+	void presentScaledFrame() {
+		if (image_exists(this->presentColorBuffer)) {
+			// The scaled size is not the same as width and height when multisampling
+			int scaledWidth = image_getWidth(this->scaledColorBuffer);
+			int scaledHeight = image_getHeight(this->scaledColorBuffer);
+			int pixelWidth = this->presentWidth / scaledWidth;
+			int pixelHeight = this->presentHeight / scaledHeight;
+			if (this->upscaleSampler == Sampler::Nearest && scaledWidth * pixelWidth == this->presentWidth && scaledHeight * pixelHeight == this->presentHeight) {
+				// Whole pixels can use the faster block magnification
+				filter_blockMagnify(this->presentColorBuffer, this->scaledColorBuffer, pixelWidth, pixelHeight);
+			} else {
+				imageImpl_resizeToTarget(*(this->presentColorBuffer.get()), *(this->scaledColorBuffer.get()), this->upscaleSampler == Sampler::Linear);
+			}
+		}
+		resampleDepth(this->presentDepthBuffer.get(), this->scaledDepthBuffer.get());
+		resampleDepth(this->presentQuantizedDepthBuffer.get(), this->scaledQuantizedDepthBuffer.get());
+		this->presentColorBuffer = ImageRgbaU8();
+		this->presentDepthBuffer = ImageF32();
+		this->presentQuantizedDepthBuffer = ImageU16();
+	}
+	// Chooses the resolution scale of the next frame from the time that the last frame took.
+	//   The cost of drawing pixels grows with the area, so the scale is multiplied by the square root of how many times faster the frame has to be.
+	//   The scale is rounded to steps of one sixteenth, so that the scaled images do not have to be reallocated for every small change.
+	//   Reducing the scale is done at once to recover from load spikes, while increasing is done one step at a time when there is a margin to spare.
+	void updateResolutionScale(double frameSeconds) {
+		static const float stepsPerUnit = 16.0f;
+		if (frameSeconds <= 0.0) {
+			return;
+		}
+		float wantedScale = this->resolutionScale * (float)std::sqrt(this->targetFrameSeconds / frameSeconds);
+		float newScale = this->resolutionScale;
+		if (frameSeconds > this->targetFrameSeconds) {
+			newScale = std::floor(wantedScale * stepsPerUnit) / stepsPerUnit;
+		} else if (frameSeconds < this->targetFrameSeconds * 0.8) {
+			newScale = std::min(wantedScale, this->resolutionScale + 1.0f / stepsPerUnit);
+			newScale = std::max(this->resolutionScale, std::floor(newScale * stepsPerUnit) / stepsPerUnit);
+		}
+		if (newScale < this->minimumResolutionScale) { newScale = this->minimumResolutionScale; }
+		if (newScale > 1.0f) { newScale = 1.0f; }
+		this->resolutionScale = newScale;
+	}
+	void setDynamicResolution(double targetSeconds, float minimumScale, Sampler upscaleSampler) {
+		if (this->receiving) {
+			throwError("Cannot call renderer_setDynamicResolution between renderer_begin and renderer_end!\n");
+		}
+		if (!(minimumScale > 0.0f && minimumScale <= 1.0f)) {
+			throwError("The minimum scale ", minimumScale, " given to renderer_setDynamicResolution is not within the range from zero exclusive to one inclusive!\n");
+		}
+		this->dynamicResolution = targetSeconds > 0.0;
+		this->targetFrameSeconds = this->dynamicResolution ? targetSeconds : 0.0;
+		this->minimumResolutionScale = minimumScale;
+		this->upscaleSampler = upscaleSampler;
+		if (this->dynamicResolution) {
+			if (this->resolutionScale < minimumScale) {
+				this->resolutionScale = minimumScale;
+			}
+		} else {
+			// Return to full resolution and free the scaled images when no longer used
+			this->resolutionScale = 1.0f;
+			this->scaledColorBuffer = ImageRgbaU8();
+			this->scaledDepthBuffer = ImageF32();
+			this->scaledQuantizedDepthBuffer = ImageU16();
+		}
+	}
+	// Returns the depth buffer being rendered to, where 16-bit depth is quantized using the camera's depth range
+	DepthTarget getDepthTarget(const Camera &camera) const {
+		if (image_exists(this->quantizedDepthBuffer)) {
+			return DepthTarget(this->quantizedDepthBuffer.get(), camera);
+		} else {
+			return DepthTarget(this->depthBuffer.get());
+		}
+	}
+	// Returns true iff the images being rendered to have another resolution than the images given to renderer_begin
+	bool isTargetResized() const {
+		return this->multisampling || this->scaledFrame;
+	}
+	// Returns the camera projecting to the images being rendered to, which have twice the resolution when multisampling
+	//   and are scaled by resolutionScale when using dynamic resolution.
+	Camera getTargetCamera(const Camera &camera) const {
+		if (this->isTargetResized()) {
+			return camera.getResized(camera.imageWidth * this->width / this->presentWidth, camera.imageHeight * this->height / this->presentHeight);
+		} else {
+			return camera;
+		}
+	}
+	void setPartitionCount(int partitionCount) {
+		if (this->receiving) {
+			throwError("Cannot call renderer_setPartitionCount between renderer_begin and renderer_end!\n");
+		}
+		if (partitionCount < 1) {
+			throwError("Cannot call renderer_setPartitionCount with less than one partition!\n");
+		}
+		while (this->partitionQueues.length() < partitionCount - 1) {
+			this->partitionQueues.push(CommandQueue());
+			this->partitionStatistics.push(RenderStatistics());
+		}
+		while (this->partitionQueues.length() > partitionCount - 1) {
+			this->partitionQueues.pop();
+			this->partitionStatistics.pop();
+		}
+	}
+	CommandQueue *getPartitionQueue(int partition) {
+		if (partition == 0) {
+			return &(this->commandQueue);
+		} else if (partition > 0 && partition <= this->partitionQueues.length()) {
+			return &(this->partitionQueues[partition - 1]);
+		} else {
+			throwError("The partition index ", partition, " given to renderer_giveTask is outside of the ", this->partitionQueues.length() + 1, " partitions set by renderer_setPartitionCount!\n");
+			return nullptr;
+		}
+	}
+	// Moves triangles from the other partitions into commandQueue, so that they can be occluded and drawn together
+	//   Must be called from a single thread, after all threads giving tasks are done.
+	void mergePartitions() {
+		for (int p = 0; p < this->partitionQueues.length(); p++) {
+			this->commandQueue.append(this->partitionQueues[p]);
+			if (this->collectingStatistics) {
+				RenderStatistics &source = this->partitionStatistics[p];
+				this->statistics.trianglesSubmitted += source.trianglesSubmitted;
+				this->statistics.trianglesCulledByFrustum += source.trianglesCulledByFrustum;
+				this->statistics.trianglesCulledByFacing += source.trianglesCulledByFacing;
+				this->statistics.trianglesClipped += source.trianglesClipped;
+				source = RenderStatistics();
+			}
+		}
+	}
+	void setMultisampling(bool multisampling) {
+		if (this->receiving) {
+			throwError("Cannot call renderer_setMultisampling between renderer_begin and renderer_end!\n");
+		}
+		this->multisampling = multisampling;
+		if (!multisampling) {
+			// Free the sample images when no longer used
+			this->sampleColorBuffer = ImageRgbaU8();
+			this->sampleDepthBuffer = ImageF32();
+			this->sampleQuantizedDepthBuffer = ImageU16();
+		}
+	}
 	bool pointInsideOfEdge(const LVector2D &edgeA, const LVector2D &edgeB, const LVector2D &point) {
 		LVector2D edgeDirection = LVector2D(edgeB.y - edgeA.y, edgeA.x - edgeB.x);
 		LVector2D relativePosition = point - edgeA;
@@ -301,17 +571,16 @@ struct RendererImpl {
 	// If any occluder has been used during this pass, all triangles in the buffer will be filtered based using depthGrid
 	void completeOcclusion() {
 		if (this->occluded) {
-			for (int t = this->commandQueue.buffer.length() - 1; t >= 0; t--) {
+			double startTime = this->collectingStatistics ? time_getSeconds() : 0.0;
+			for (int t = this->commandQueue.length() - 1; t >= 0; t--) {
 				bool anyVisible = false;
-				ITriangle2D triangle = this->commandQueue.buffer[t].triangle;
-				IRect outerBound = getOuterCellBound(triangle.wholeBound);
+				TriangleDrawHeader &header = this->commandQueue.headers[t];
+				IRect outerBound = getOuterCellBound(this->commandQueue.commands[t].triangle.wholeBound);
+				float triangleDepth = header.nearDepth;
 				for (int cellY = outerBound.top(); cellY < outerBound.bottom(); cellY++) {
 					for (int cellX = outerBound.left(); cellX < outerBound.right(); cellX++) {
 						// TODO: Optimize access using SafePointer iteration
 						float backgroundDepth = image_readPixel_clamp(this->depthGrid, cellX, cellY);
-						float triangleDepth = triangle.position[0].cs.z;
-						replaceWithSmaller(triangleDepth, triangle.position[1].cs.z);
-						replaceWithSmaller(triangleDepth, triangle.position[2].cs.z);
 						if (triangleDepth < backgroundDepth + 0.001) {
 							anyVisible = true;
 						}
@@ -319,9 +588,15 @@ struct RendererImpl {
 				}
 				if (!anyVisible) {
 					// TODO: Make triangle swapping work so that the list can be sorted
-					this->commandQueue.buffer[t].occluded = true;
+					header.occluded = true;
+					if (this->collectingStatistics) {
+						this->statistics.trianglesCulledByOcclusion++;
+					}
 				}
 			}
+			if (this->collectingStatistics) {
+				this->statistics.occlusionSeconds = time_getSeconds() - startTime;
+			}
 		}
 	}
 	void occludeFromSortedHull(const ProjectedPoint* convexHullCorners, int cornerCount, const IRect& pixelBound) {
@@ -362,13 +637,14 @@ struct RendererImpl {
 			throwError("Cannot call renderer_occludeFromExistingTriangles without first calling renderer_begin!\n");
 		}
 		prepareForOcclusion();
+		mergePartitions();
 		// Generate a depth grid to remove many small triangles behind larger triangles
 		//   This will leave triangles along seams but at least begin to remove the worst unwanted drawing
-		for (int t = 0; t < this->commandQueue.buffer.length(); t++) {
+		for (int t = 0; t < this->commandQueue.length(); t++) {
 			// Get the current triangle from the queue
-			Filter filter = this->commandQueue.buffer[t].filter;
+			Filter filter = this->commandQueue.states[this->commandQueue.headers[t].stateIndex].filter;
 			if (filter == Filter::Solid) {
-				ITriangle2D triangle = this->commandQueue.buffer[t].triangle;
+				const ITriangle2D &triangle = this->commandQueue.commands[t].triangle;
 				occludeFromSortedHull(triangle.position, 3, triangle.wholeBound);
 			}
 		}
@@ -518,10 +794,12 @@ struct RendererImpl {
 		ProjectedPoint projections[8];
 		return isHullOccluded(projections, corners, 8, modelToWorldTransform, camera);
 	}
-	void giveTask(const Model& model, const Transform3D &modelToWorldTransform, const Camera &camera) {
+	// Only writes to the command queue of the given partition, so that different partitions can be given tasks from different threads
+	void giveTask(const Model& model, const Transform3D &modelToWorldTransform, const Camera &camera, int partition) {
 		if (!this->receiving) {
 			throwError("Cannot call renderer_giveTask before renderer_begin!\n");
 		}
+		CommandQueue *queue = getPartitionQueue(partition);
 		// If occluders are present, check if the model's bound is visible
 		if (this->occluded) {
 			FVector3D minimum, maximum;
@@ -536,17 +814,32 @@ struct RendererImpl {
 		//           Because the model is being borrowed for vertex animation
 		//           To prevent the command queue from getting full hold as much as possible in a sorted list of instances
 		//           When the command queue is full, the solid instances will be drawn front to back before filtered is drawn back to front
-		model->render(&this->commandQueue, this->colorBuffer, this->depthBuffer, modelToWorldTransform, camera);
+		model->render(queue, this->colorBuffer, this->getDepthTarget(camera), modelToWorldTransform, camera);
 	}
 	void endFrame(bool debugWireframe) {
 		if (!this->receiving) {
 			throwError("Called renderer_end without renderer_begin!\n");
 		}
 		this->receiving = false;
+		mergePartitions();
 		// Mark occluded triangles to prevent them from being rendered
 		completeOcclusion();
+		this->commandQueue.multisampled = this->multisampling;
 		this->commandQueue.execute(IRect::FromSize(this->width, this->height));
-		if (image_exists(this->colorBuffer)) {
+		// Debug lines are drawn on the resolved image, with coordinates divided by the number of samples along each axis
+		ImageRgbaU8 overlayTarget = this->colorBuffer;
+		int64_t overlayScale = 1;
+		if (this->multisampling) {
+			resolveSamples(this->resolvedColorBuffer.get(), this->resolvedDepthBuffer.get(), this->colorBuffer.get(), this->depthBuffer.get());
+			resolveSamples(nullptr, this->resolvedQuantizedDepthBuffer.get(), nullptr, this->quantizedDepthBuffer.get());
+			overlayTarget = this->resolvedColorBuffer;
+			overlayScale = 2;
+			this->resolvedColorBuffer = ImageRgbaU8();
+			this->resolvedDepthBuffer = ImageF32();
+			this->resolvedQuantizedDepthBuffer = ImageU16();
+		}
+		int64_t unitsPerOverlayPixel = constants::unitsPerPixel * overlayScale;
+		if (image_exists(overlayTarget)) {
 			// Debug drawn triangles
 			if (debugWireframe) {
 				/*if (image_exists(this->depthGrid)) {
@@ -560,22 +853,22 @@ struct RendererImpl {
 						}
 					}
 				}*/
-				for (int t = 0; t < this->commandQueue.buffer.length(); t++) {
-					if (!this->commandQueue.buffer[t].occluded) {
-						ITriangle2D *triangle = &(this->commandQueue.buffer[t].triangle);
-						draw_line(this->colorBuffer,
-						  triangle->position[0].flat.x / constants::unitsPerPixel, triangle->position[0].flat.y / constants::unitsPerPixel,
-						  triangle->position[1].flat.x / constants::unitsPerPixel, triangle->position[1].flat.y / constants::unitsPerPixel,
+				for (int t = 0; t < this->commandQueue.length(); t++) {
+					if (!this->commandQueue.headers[t].occluded) {
+						const ITriangle2D *triangle = &(this->commandQueue.commands[t].triangle);
+						draw_line(overlayTarget,
+						  triangle->position[0].flat.x / unitsPerOverlayPixel, triangle->position[0].flat.y / unitsPerOverlayPixel,
+						  triangle->position[1].flat.x / unitsPerOverlayPixel, triangle->position[1].flat.y / unitsPerOverlayPixel,
 						  ColorRgbaI32(255, 255, 255, 255)
 						);
-						draw_line(this->colorBuffer,
-						  triangle->position[1].flat.x / constants::unitsPerPixel, triangle->position[1].flat.y / constants::unitsPerPixel,
-						  triangle->position[2].flat.x / constants::unitsPerPixel, triangle->position[2].flat.y / constants::unitsPerPixel,
+						draw_line(overlayTarget,
+						  triangle->position[1].flat.x / unitsPerOverlayPixel, triangle->position[1].flat.y / unitsPerOverlayPixel,
+						  triangle->position[2].flat.x / unitsPerOverlayPixel, triangle->position[2].flat.y / unitsPerOverlayPixel,
 						  ColorRgbaI32(255, 255, 255, 255)
 						);
-						draw_line(this->colorBuffer,
-						  triangle->position[2].flat.x / constants::unitsPerPixel, triangle->position[2].flat.y / constants::unitsPerPixel,
-						  triangle->position[0].flat.x / constants::unitsPerPixel, triangle->position[0].flat.y / constants::unitsPerPixel,
+						draw_line(overlayTarget,
+						  triangle->position[2].flat.x / unitsPerOverlayPixel, triangle->position[2].flat.y / unitsPerOverlayPixel,
+						  triangle->position[0].flat.x / unitsPerOverlayPixel, triangle->position[0].flat.y / unitsPerOverlayPixel,
 						  ColorRgbaI32(255, 255, 255, 255)
 						);
 					}
@@ -583,11 +876,62 @@ struct RendererImpl {
 			}
 			// Debug anything else added to debugLines
 			for (int l = 0; l < this->debugLines.length(); l++) {
-				draw_line(this->colorBuffer, this->debugLines[l].x1, this->debugLines[l].y1, this->debugLines[l].x2, this->debugLines[l].y2, this->debugLines[l].color);
+				const DebugLine &line = this->debugLines[l];
+				draw_line(overlayTarget, line.x1 / overlayScale, line.y1 / overlayScale, line.x2 / overlayScale, line.y2 / overlayScale, line.color);
 			}
 			this->debugLines.clear();
 		}
 		this->commandQueue.clear();
+		// Debug overlays are drawn before upscaling, because they use the coordinates of the scaled images
+		if (this->scaledFrame) {
+			this->presentScaledFrame();
+			this->scaledFrame = false;
+		}
+		if (this->dynamicResolution) {
+			this->updateResolutionScale(time_getSeconds() - this->frameStartTime);
+		}
+	}
+	// The same as occludeFromTopRows for a 16-bit depth buffer, where the lowest value in each row of a cell is the farthest away.
+	void occludeFromTopRowsQuantized(const Camera &camera) {
+		DepthTarget depthTarget = this->getDepthTarget(camera);
+		SafePointer<uint16_t> depthRow = image_getSafePointer(this->quantizedDepthBuffer);
+		int depthStride = image_getStride(this->quantizedDepthBuffer);
+		SafePointer<float> gridRow = image_getSafePointer(this->depthGrid);
+		int gridStride = image_getStride(this->depthGrid);
+		for (int y = 0; y < this->height; y += cellSize) {
+			SafePointer<float> gridPixel = gridRow;
+			SafePointer<uint16_t> depthPixel = depthRow;
+			int x = 0;
+			int right = cellSize - 1;
+			// Scan bottom row of whole cell width
+			for (int gridX = 0; gridX < this->gridWidth; gridX++) {
+				int minValue = 65535;
+				if (right >= this->width) { right = this->width; }
+				while (x < right) {
+					int newValue = *depthPixel;
+					if (newValue < minValue) { minValue = newValue; }
+					depthPixel += 1;
+					x += 1;
+				}
+				// The stored value may have been rounded up by half a step
+				float depth = depthTarget.dequantize(minValue - 0.5f);
+				float maxDistance;
+				if (camera.perspective) {
+					maxDistance = depth > 0.0f ? 1.0f / depth : std::numeric_limits<float>::infinity();
+				} else {
+					maxDistance = depth;
+				}
+				float oldDistance = *gridPixel;
+				if (maxDistance < oldDistance) {
+					*gridPixel = maxDistance;
+				}
+				gridPixel += 1;
+				right += cellSize;
+			}
+			// Go to the next grid row
+			depthRow.increaseBytes(depthStride * cellSize);
+			gridRow.increaseBytes(gridStride);
+		}
 	}
 	void occludeFromTopRows(const Camera &camera) {
 		// Make sure that the depth grid exists with the correct dimensions.
@@ -595,6 +939,10 @@ struct RendererImpl {
 		if (!this->receiving) {
 			throwError("Cannot call renderer_occludeFromTopRows without first calling renderer_begin!\n");
 		}
+		if (image_exists(this->quantizedDepthBuffer)) {
+			this->occludeFromTopRowsQuantized(camera);
+			return;
+		}
 		if (!image_exists(this->depthBuffer)) {
 			throwError("Cannot call renderer_occludeFromTopRows without having given a depth buffer in renderer_begin!\n");
 		}
@@ -676,7 +1024,12 @@ bool renderer_exists(const Renderer& renderer) {
 
 void renderer_begin(Renderer& renderer, ImageRgbaU8& colorBuffer, ImageF32& depthBuffer) {
 	MUST_EXIST(renderer,renderer_begin);
-	renderer->beginFrame(colorBuffer, depthBuffer);
+	renderer->beginFrame(colorBuffer, depthBuffer, ImageU16());
+}
+
+void renderer_begin(Renderer& renderer, ImageRgbaU8& colorBuffer, ImageU16& depthBuffer) {
+	MUST_EXIST(renderer,renderer_begin);
+	renderer->beginFrame(colorBuffer, ImageF32(), depthBuffer);
 }
 
 // TODO: Synchronous setting
@@ -687,10 +1040,10 @@ void renderer_begin(Renderer& renderer, ImageRgbaU8& colorBuffer, ImageF32& dept
 //         Dispatch triangles directly to the command queue so that the current state of the model is captured
 //         This allow rendering many instances using the same model at different times
 //         Enabling vertex light, reflection maps and bone animation
-void renderer_giveTask(Renderer& renderer, const Model& model, const Transform3D &modelToWorldTransform, const Camera &camera) {
+void renderer_giveTask(Renderer& renderer, const Model& model, const Transform3D &modelToWorldTransform, const Camera &camera, int partition) {
 	MUST_EXIST(renderer,renderer_giveTask);
 	if (model.get() != nullptr) {
-		renderer->giveTask(model, modelToWorldTransform, camera);
+		renderer->giveTask(model, modelToWorldTransform, renderer->getTargetCamera(camera), partition);
 	}
 }
 
@@ -709,8 +1062,20 @@ void renderer_giveTask_triangle(Renderer& renderer,
 		}
 		MUST_EXIST(renderer,renderer_addTriangle);
 	#endif
+	if (renderer->isTargetResized()) {
+		// Project the points again for the resolution of the samples or scaled images
+		Camera sampleCamera = renderer->getTargetCamera(camera);
+		renderTriangleFromData(
+		  &(renderer->commandQueue), renderer->colorBuffer.get(), renderer->getDepthTarget(sampleCamera), sampleCamera,
+		  sampleCamera.cameraToScreen(posA.cs), sampleCamera.cameraToScreen(posB.cs), sampleCamera.cameraToScreen(posC.cs),
+		  filter, diffuseMap.get(), lightMap.get(),
+		  TriangleTexCoords(texCoordA, texCoordB, texCoordC),
+		  TriangleColors(colorA, colorB, colorC)
+		);
+		return;
+	}
 	renderTriangleFromData(
-	  &(renderer->commandQueue), renderer->colorBuffer.get(), renderer->depthBuffer.get(), camera,
+	  &(renderer->commandQueue), renderer->colorBuffer.get(), renderer->getDepthTarget(camera), camera,
 	  posA, posB, posC,
 	  filter, diffuseMap.get(), lightMap.get(),
 	  TriangleTexCoords(texCoordA, texCoordB, texCoordC),
@@ -720,7 +1085,7 @@ void renderer_giveTask_triangle(Renderer& renderer,
 
 void renderer_occludeFromBox(Renderer& renderer, const FVector3D& minimum, const FVector3D& maximum, const Transform3D &modelToWorldTransform, const Camera &camera, bool debugSilhouette) {
 	MUST_EXIST(renderer,renderer_occludeFromBox);
-	renderer->occludeFromBox(minimum, maximum, modelToWorldTransform, camera, debugSilhouette);
+	renderer->occludeFromBox(minimum, maximum, modelToWorldTransform, renderer->getTargetCamera(camera), debugSilhouette);
 }
 
 void renderer_occludeFromExistingTriangles(Renderer& renderer) {
@@ -735,7 +1100,80 @@ void renderer_occludeFromTopRows(Renderer& renderer, const Camera &camera) {
 
 bool renderer_isBoxVisible(Renderer& renderer, const FVector3D &minimum, const FVector3D &maximum, const Transform3D &modelToWorldTransform, const Camera &camera) {
 	MUST_EXIST(renderer,renderer_isBoxVisible);
-	return !(renderer->isBoxOccluded(minimum, maximum, modelToWorldTransform, camera));
+	return !(renderer->isBoxOccluded(minimum, maximum, modelToWorldTransform, renderer->getTargetCamera(camera)));
+}
+
+void renderer_setDrawOrder(Renderer& renderer, DrawOrder drawOrder) {
+	MUST_EXIST(renderer,renderer_setDrawOrder);
+	renderer->commandQueue.drawOrder = drawOrder;
+}
+
+DrawOrder renderer_getDrawOrder(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getDrawOrder);
+	return renderer->commandQueue.drawOrder;
+}
+
+void renderer_setDepthPrePass(Renderer& renderer, bool depthPrePass) {
+	MUST_EXIST(renderer,renderer_setDepthPrePass);
+	renderer->commandQueue.depthPrePass = depthPrePass;
+}
+
+bool renderer_getDepthPrePass(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getDepthPrePass);
+	return renderer->commandQueue.depthPrePass;
+}
+
+void renderer_setPartitionCount(Renderer& renderer, int partitionCount) {
+	MUST_EXIST(renderer,renderer_setPartitionCount);
+	renderer->setPartitionCount(partitionCount);
+}
+
+int renderer_getPartitionCount(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getPartitionCount);
+	return renderer->partitionQueues.length() + 1;
+}
+
+void renderer_setMultisampling(Renderer& renderer, bool multisampling) {
+	MUST_EXIST(renderer,renderer_setMultisampling);
+	renderer->setMultisampling(multisampling);
+}
+
+bool renderer_getMultisampling(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getMultisampling);
+	return renderer->multisampling;
+}
+
+void renderer_setDynamicResolution(Renderer& renderer, double targetSeconds, float minimumScale, Sampler upscaleSampler) {
+	MUST_EXIST(renderer,renderer_setDynamicResolution);
+	renderer->setDynamicResolution(targetSeconds, minimumScale, upscaleSampler);
+}
+
+double renderer_getDynamicResolution(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getDynamicResolution);
+	return renderer->targetFrameSeconds;
+}
+
+float renderer_getResolutionScale(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getResolutionScale);
+	return renderer->resolutionScale;
+}
+
+void renderer_setStatisticsEnabled(Renderer& renderer, bool enabled) {
+	MUST_EXIST(renderer,renderer_setStatisticsEnabled);
+	if (renderer->receiving) {
+		throwError("Cannot call renderer_setStatisticsEnabled between renderer_begin and renderer_end!\n");
+	}
+	renderer->collectingStatistics = enabled;
+}
+
+bool renderer_getStatisticsEnabled(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getStatisticsEnabled);
+	return renderer->collectingStatistics;
+}
+
+RenderStatistics renderer_getStatistics(const Renderer& renderer) {
+	MUST_EXIST(renderer,renderer_getStatistics);
+	return renderer->statistics;
 }
 
 void renderer_end(Renderer& renderer, bool debugWireframe) {
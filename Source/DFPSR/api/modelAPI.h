@@ -29,6 +29,7 @@
 
 // TODO: How should these be exposed to the caller?
 #include "../render/Camera.h"
+#include "../render/RenderStatistics.h"
 #include "../render/ResourcePool.h"
 #include "../render/model/format/dmf1.h"
 
@@ -276,12 +277,18 @@ namespace dsr {
 	// Side-effect: Render any model transformed by modelToWorldTransform, seen from camera, to any colorBuffer using any depthBuffer.
 	//   An empty model handle will be skipped silently, which can be used instead of an model with zero polygons.
 	void model_render(const Model& model, const Transform3D &modelToWorldTransform, ImageRgbaU8& colorBuffer, ImageF32& depthBuffer, const Camera &camera);
+	// Rendering with a 16-bit depth buffer, which halves the memory used for reading and writing depth.
+	//   The camera's depth range is stored from 65535 at depthRangeNear to 0 at depthRangeFar, so clear depthBuffer to zero before drawing.
+	//   Use Camera::getWithDepthRange to select a range as narrow as possible around the visible geometry for the best precision.
+	void model_render(const Model& model, const Transform3D &modelToWorldTransform, ImageRgbaU8& colorBuffer, ImageU16& depthBuffer, const Camera &camera);
 	// Simpler rendering without colorBuffer, for shadows and other depth effects
 	//   Equivalent to model_render with a non-existing colorBuffer and filter forced to solid.
 	//   Skip this call conditionally for filtered models (using model_getFilter) if you want full equivalence with model_render.
 	// Side-effect: Render any model transformed by modelToWorldTransform, seen from camera, to any depthBuffer.
 	//   An empty model handle will be skipped silently, which can be used instead of an model with zero polygons.
 	void model_renderDepth(const Model& model, const Transform3D &modelToWorldTransform, ImageF32& depthBuffer, const Camera &camera);
+	// Rendering depth to a 16-bit depth buffer, quantized in the same way as for model_render.
+	void model_renderDepth(const Model& model, const Transform3D &modelToWorldTransform, ImageU16& depthBuffer, const Camera &camera);
 
 	// Multi-threaded rendering (Huge performance boost with more CPU cores!)
 	// Post-condition: Returns the handle to a new multi-threaded rendering context.
@@ -300,6 +307,10 @@ namespace dsr {
 	//   renderer must refer to an existing renderer.
 	//   colorBuffer and depthBuffer must have the same dimensions.
 	void renderer_begin(Renderer& renderer, ImageRgbaU8& colorBuffer, ImageF32& depthBuffer);
+	// Prepares for rendering with a 16-bit depth buffer, which halves the memory used for reading and writing depth.
+	//   Each camera given in the batch quantizes depth using its own depth range, from 65535 at depthRangeNear to 0 at depthRangeFar.
+	//   Use the same depth range for all cameras in a batch, and clear depthBuffer to zero before the first batch of a frame.
+	void renderer_begin(Renderer& renderer, ImageRgbaU8& colorBuffer, ImageU16& depthBuffer);
 	// Project an occluding box against the occlusion grid so that triangles hidden behind it will not be drawn.
 	// Occluders may only be placed within solid geometry, because otherwise it may affect the visual result.
 	// Should ideally be used before giving render tasks, so that optimizations can take advantage of early occlusion checks.
@@ -323,7 +334,20 @@ namespace dsr {
 	// Pre-condition: renderer must refer to an existing renderer.
 	// An empty model handle will be skipped silently, which can be used instead of an model with zero polygons.
 	// Side-effect: The visible triangles are queued up in the renderer.
-	void renderer_giveTask(Renderer& renderer, const Model& model, const Transform3D &modelToWorldTransform, const Camera &camera);
+	// partition selects which of the renderer's command queues receives the triangles, as described for renderer_setPartitionCount.
+	//   Calls with different partitions may be made from different threads at the same time, but each partition may only be used by one thread at a time.
+	//   Occluders must be given before any thread starts giving tasks, because the occlusion grid is read while giving tasks.
+	//   The triangles of all partitions are drawn together in renderer_end, in the order of partitions and then the order of calls within each partition.
+	void renderer_giveTask(Renderer& renderer, const Model& model, const Transform3D &modelToWorldTransform, const Camera &camera, int partition = 0);
+	// Sets the number of partitions that renderer_giveTask can use, which is 1 by default.
+	//   Each partition has its own command queue, so that models can be projected and clipped on multiple threads without locking,
+	//   for example by letting each thread give the tasks for its own part of the scene using the thread's index as the partition.
+	//   The queues are kept between frames, so that their memory is reused.
+	// Pre-condition: renderer must refer to an existing renderer that is not between renderer_begin and renderer_end, and partitionCount must be at least 1.
+	void renderer_setPartitionCount(Renderer& renderer, int partitionCount);
+	// Pre-condition: renderer must refer to an existing renderer.
+	// Post-condition: Returns the number of partitions that renderer_giveTask can use.
+	int renderer_getPartitionCount(const Renderer& renderer);
 	// A move powerful alternative to renderer_giveTask, sending one triangle at a time without occlusion tests.
 	//   Call renderer_isBoxVisible for the whole model's bounding box to check if the triangles in your own representation should be drawn.
 	// Useful for engine specific model formats allowing vertex animation, vertex shading and texture shading.
@@ -362,6 +386,74 @@ namespace dsr {
 	// Use already given triangles as occluders.
 	//   Used after calls to renderer_giveTask have filled the buffer with triangles, but before they are drawn using renderer_end.
 	void renderer_occludeFromExistingTriangles(Renderer& renderer);
+	// Selects the order in which triangles are drawn during renderer_end.
+	//   DrawOrder::Submitted (default) draws triangles in the order that they were given.
+	//   DrawOrder::Depth draws solid triangles from front to back, so that the depth test can skip hidden pixels,
+	//   followed by alpha filtered triangles from back to front, so that blending does not depend on the order of tasks.
+	//   The order is only sorted approximately using each triangle's nearest or farthest corner, so intersecting alpha filtered triangles may still blend in the wrong order.
+	// Pre-condition: renderer must refer to an existing renderer.
+	void renderer_setDrawOrder(Renderer& renderer, DrawOrder drawOrder);
+	// Pre-condition: renderer must refer to an existing renderer.
+	// Post-condition: Returns the draw order given to renderer_setDrawOrder, or DrawOrder::Submitted by default.
+	DrawOrder renderer_getDrawOrder(const Renderer& renderer);
+	// Enables or disables the depth pre-pass in renderer_end, which is disabled by default.
+	//   The first phase draws depth for all solid triangles using a cheaper depth-only rasterizer.
+	//   The second phase shades the triangles against the completed depth buffer, so that hidden pixels are not shaded.
+	//   This saves time when expensive texture sampling is covered by other triangles, but costs an extra depth pass when there is little overdraw.
+	//   Only affects triangles with Filter::Solid drawn with a depth buffer.
+	// Pre-condition: renderer must refer to an existing renderer.
+	void renderer_setDepthPrePass(Renderer& renderer, bool depthPrePass);
+	// Pre-condition: renderer must refer to an existing renderer.
+	// Post-condition: Returns true iff renderer_end will begin with a depth pre-pass.
+	bool renderer_getDepthPrePass(const Renderer& renderer);
+	// Enables or disables 4x multisample anti-aliasing for following frames, which is disabled by default.
+	//   Each pixel gets 2x2 samples in an ordered grid, which are tested for coverage and depth one by one,
+	//   while the shader is only called once for each pixel at its center.
+	//   The samples are rendered into images of twice the width and height owned by the renderer,
+	//     starting with copies of the images given to renderer_begin and averaged back into them in renderer_end.
+	//   The resolved depth buffer gets the depth of each pixel's upper left sample.
+	//   Cameras given while multisampling should still have the resolution of the images given to renderer_begin.
+	// Pre-condition: renderer must refer to an existing renderer that is not between renderer_begin and renderer_end.
+	void renderer_setMultisampling(Renderer& renderer, bool multisampling);
+	// Pre-condition: renderer must refer to an existing renderer.
+	// Post-condition: Returns true iff multisample anti-aliasing is enabled.
+	bool renderer_getMultisampling(const Renderer& renderer);
+	// Enables dynamic resolution scaling for following frames when targetSeconds is positive, or disables it when targetSeconds is zero, which is the default.
+	//   Each frame is rendered into images owned by the renderer, with the width and height of the images given to renderer_begin multiplied by a resolution scale.
+	//     renderer_begin starts them with a nearest neighbor copy of the given images, and renderer_end upscales them back into the given images.
+	//   The resolution scale is chosen from the time between renderer_begin and the end of renderer_end in the previous frame,
+	//     reducing it at once when the frame took longer than targetSeconds and increasing it gradually when there is time to spare.
+	//     The scale is a multiple of 1 / 16 from minimumScale to 1, so that frame rates can stay stable under load spikes without reallocating images for each frame.
+	//   upscaleSampler selects how the color image is upscaled.
+	//     Sampler::Linear interpolates colors using the same filter as filter_resize.
+	//     Sampler::Nearest uses filter_blockMagnify when the scaled size is a whole fraction of the full size, and nearest neighbor resizing otherwise.
+	//     The depth buffers always use the nearest pixel, because interpolated depth would not belong to any triangle.
+	//   Cameras given while using dynamic resolution should still have the resolution of the images given to renderer_begin.
+	//   Can be combined with multisampling, which then takes samples from the scaled images.
+	// Pre-condition:
+	//   renderer must refer to an existing renderer that is not between renderer_begin and renderer_end.
+	//   minimumScale must be larger than zero and at most one.
+	void renderer_setDynamicResolution(Renderer& renderer, double targetSeconds, float minimumScale = 0.5f, Sampler upscaleSampler = Sampler::Linear);
+	// Pre-condition: renderer must refer to an existing renderer.
+	// Post-condition: Returns the target frame time in seconds given to renderer_setDynamicResolution, or zero when dynamic resolution is disabled.
+	double renderer_getDynamicResolution(const Renderer& renderer);
+	// Pre-condition: renderer must refer to an existing renderer.
+	// Post-condition: Returns the resolution scale of the frame being rendered between renderer_begin and renderer_end, or of the next frame after renderer_end.
+	//   Always 1 when dynamic resolution is disabled.
+	float renderer_getResolutionScale(const Renderer& renderer);
+	// Enables or disables collecting statistics for following frames, which is disabled by default.
+	//   When disabled, nothing is counted or timed.
+	// Pre-condition: renderer must refer to an existing renderer that is not between renderer_begin and renderer_end.
+	void renderer_setStatisticsEnabled(Renderer& renderer, bool enabled);
+	// Pre-condition: renderer must refer to an existing renderer.
+	// Post-condition: Returns true iff statistics are collected.
+	bool renderer_getStatisticsEnabled(const Renderer& renderer);
+	// Returns counts and timings for the frame from renderer_begin to renderer_end, as described in RenderStatistics.
+	//   Called after renderer_end, it returns the statistics of the completed frame.
+	//   Called before renderer_end, it returns what has been counted so far in the current frame.
+	//   All values are zero when statistics are not enabled.
+	// Pre-condition: renderer must refer to an existing renderer.
+	RenderStatistics renderer_getStatistics(const Renderer& renderer);
 	// Side-effect: Finishes all the jobs in the rendering context so that triangles are rasterized to the targets given to renderer_begin.
 	// Pre-condition: renderer must refer to an existing renderer.
 	// If debugWireframe is true, each triangle's edges will be drawn on top of the drawn world to indicate how well the occlusion system is working
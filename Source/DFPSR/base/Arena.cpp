@@ -0,0 +1,81 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+#include "Arena.h"
+#include <cstdlib>
+#include "../api/stringAPI.h"
+
+using namespace dsr;
+
+Arena::Arena(uintptr_t minimumBlockSize) : minimumBlockSize(minimumBlockSize) {}
+
+Arena::~Arena() {
+	Block *block = this->firstBlock;
+	while (block != nullptr) {
+		Block *next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+void Arena::nextBlock(uintptr_t size, uintptr_t alignment) {
+	// Leave room for aligning the start of the data
+	uintptr_t neededCapacity = size + alignment;
+	// Reuse the following blocks if they are large enough
+	Block *candidate = (this->currentBlock == nullptr) ? this->firstBlock : this->currentBlock->next;
+	Block *previous = this->currentBlock;
+	while (candidate != nullptr && candidate->capacity < neededCapacity) {
+		previous = candidate;
+		candidate = candidate->next;
+	}
+	if (candidate == nullptr) {
+		// Each new block is at least as big as everything reserved before, so that the number of blocks stays low
+		uintptr_t capacity = this->reservedBytes > this->minimumBlockSize ? this->reservedBytes : this->minimumBlockSize;
+		if (capacity < neededCapacity) {
+			capacity = neededCapacity;
+		}
+		candidate = (Block*)malloc(sizeof(Block) + capacity);
+		if (candidate == nullptr) {
+			throwError(U"Arena failed to allocate a block of ", capacity, U" bytes!\n");
+		}
+		candidate->next = nullptr;
+		candidate->capacity = capacity;
+		this->reservedBytes += capacity;
+		if (previous == nullptr) {
+			this->firstBlock = candidate;
+		} else {
+			previous->next = candidate;
+		}
+	}
+	this->currentBlock = candidate;
+	this->currentOffset = 0;
+}
+
+void Arena::reset() {
+	this->currentBlock = nullptr;
+	this->currentOffset = 0;
+}
+
+Arena& dsr::arena_getThreadLocal() {
+	static thread_local Arena arena;
+	return arena;
+}
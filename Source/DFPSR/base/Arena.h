@@ -0,0 +1,153 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+#ifndef DFPSR_ARENA
+#define DFPSR_ARENA
+
+#include <stdint.h>
+#include <new>
+#include <type_traits>
+#include "SafePointer.h"
+
+namespace dsr {
+
+// A bump-pointer allocator for short-lived data, such as projected vertices and triangle rows while rendering.
+//   Allocating only moves an offset forward in the current block, so it is much faster than the heap.
+//   Memory is released all at once by rewinding to a marker or resetting the whole arena.
+//   Blocks are kept after rewinding, so the heap is only used until the largest frame has been seen.
+//   Not thread-safe, so each thread should use its own arena from arena_getThreadLocal.
+class Arena {
+private:
+	struct Block {
+		Block *next;
+		uintptr_t capacity;
+		uint8_t *getData() const { return (uint8_t*)(this + 1); }
+	};
+	// The first block in the chain, which is never released until the arena is destroyed
+	Block *firstBlock = nullptr;
+	// The block that allocations are currently taken from
+	Block *currentBlock = nullptr;
+	// The number of bytes used in currentBlock
+	uintptr_t currentOffset = 0;
+	// The smallest block size to ask the system for
+	uintptr_t minimumBlockSize;
+	// The number of bytes reserved from the system in all blocks
+	uintptr_t reservedBytes = 0;
+	// Returns the first offset after currentOffset in currentBlock where the address is aligned
+	inline uintptr_t alignedOffset(uintptr_t alignment) const {
+		uintptr_t address = (uintptr_t)this->currentBlock->getData() + this->currentOffset;
+		return this->currentOffset + (((alignment - (address & (alignment - 1)))) & (alignment - 1));
+	}
+	inline bool fits(uintptr_t size, uintptr_t alignment) const {
+		return this->alignedOffset(alignment) + size <= this->currentBlock->capacity;
+	}
+	// Move to the next block that can hold size bytes with the given alignment, or create one.
+	void nextBlock(uintptr_t size, uintptr_t alignment);
+public:
+	// A position in the arena to rewind back to.
+	struct Marker {
+		Block *block;
+		uintptr_t offset;
+	};
+	explicit Arena(uintptr_t minimumBlockSize = 65536);
+	~Arena();
+	// No copying, because the blocks are owned by the arena
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	// Returns size bytes aligned to alignment, which must be a power of two.
+	//   The memory is not initialized and is only valid until the arena is rewound past it or reset.
+	inline void *allocate(uintptr_t size, uintptr_t alignment = 16) {
+		if (this->currentBlock == nullptr || !this->fits(size, alignment)) {
+			this->nextBlock(size, alignment);
+		}
+		uint8_t *data = this->currentBlock->getData();
+		uintptr_t start = this->alignedOffset(alignment);
+		this->currentOffset = start + size;
+		return data + start;
+	}
+	// Get the current position, so that everything allocated after it can be released with rewind.
+	inline Marker getMarker() const {
+		return Marker{this->currentBlock, this->currentOffset};
+	}
+	// Release everything allocated since marker was taken, while keeping the blocks for later.
+	//   Markers must be rewound in the opposite order of creation.
+	inline void rewind(const Marker &marker) {
+		this->currentBlock = marker.block;
+		this->currentOffset = marker.offset;
+	}
+	// Release all allocations at once, while keeping the blocks for the next frame.
+	void reset();
+	// Returns the number of bytes reserved from the system, which only grows until the arena is destroyed.
+	uintptr_t getReservedBytes() const { return this->reservedBytes; }
+};
+
+// Returns the calling thread's own arena, which is destroyed when the thread ends.
+//   Each worker thread gets a separate arena, so that parallel rendering does not need any locks.
+Arena& arena_getThreadLocal();
+
+// A temporary array allocated from the calling thread's arena and released when going out of scope.
+//   Used instead of variable length arrays on the stack, which could overflow for large models.
+//   Only for trivially destructible element types, because no destructors are called.
+//   Elements are default-initialized like in a variable length array, so trivial types must be written before being read.
+template <typename T>
+class ArenaArray {
+private:
+	static_assert(std::is_trivially_destructible<T>::value, "ArenaArray can only hold trivially destructible elements!");
+	Arena &arena;
+	Arena::Marker marker;
+	T *data;
+	int32_t elementCount;
+public:
+	explicit ArenaArray(int32_t elementCount)
+	: arena(arena_getThreadLocal()), marker(arena.getMarker()), elementCount(elementCount) {
+		this->data = (T*)this->arena.allocate((uintptr_t)elementCount * sizeof(T), alignof(T) < 16 ? 16 : alignof(T));
+		// Default-initialized like a variable length array, so trivial types are left uninitialized
+		for (int32_t i = 0; i < elementCount; i++) {
+			new (this->data + i) T;
+		}
+	}
+	~ArenaArray() {
+		this->arena.rewind(this->marker);
+	}
+	// No copying, because the memory belongs to one scope
+	ArenaArray(const ArenaArray&) = delete;
+	ArenaArray& operator=(const ArenaArray&) = delete;
+	inline T &operator[](int32_t index) {
+		assert(index >= 0 && index < this->elementCount);
+		return this->data[index];
+	}
+	inline const T &operator[](int32_t index) const {
+		assert(index >= 0 && index < this->elementCount);
+		return this->data[index];
+	}
+	inline int32_t length() const { return this->elementCount; }
+	// Back to unsafe pointer with a clearly visible method name as a warning
+	inline T *getUnsafe() { return this->data; }
+	inline const T *getUnsafe() const { return this->data; }
+	inline SafePointer<T> getSafe(const char *name) {
+		return SafePointer<T>(name, this->data, this->elementCount * (int32_t)sizeof(T));
+	}
+};
+
+}
+
+#endif
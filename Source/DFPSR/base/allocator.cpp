@@ -1,13 +1,25 @@
 
-// This allocator does not have any header and can be disabled by not linking it into the application
+// This allocator is used without including any header and can be disabled by not linking it into the application
 // or by defining DISABLE_ALLOCATOR (usually with a -DDISABLE_ALLOCATOR compiler flag).
+//   Include allocator.h to get statistics about the allocator's memory use.
+#include "allocator.h"
+
 #ifndef DISABLE_ALLOCATOR
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <mutex>
+#include <atomic>
+
+// Scrubbing clears old data when an allocation is recycled to make debugging easier.
+//   Disabled in release mode, where it would only waste memory bandwidth on large recycled allocations.
+//   Define ALLOCATOR_SCRUB to scrub in release mode too.
+#ifndef NDEBUG
+	#define ALLOCATOR_SCRUB
+#endif
 
+// Only needed when moving allocations between a thread's cache and the global garbage piles
 static std::mutex allocationLock;
 
 // Allocation head stored in the beginning of each allocation
@@ -21,15 +33,38 @@ struct AllocationHead {
 static const uintptr_t alignedHeadSize = 16;
 static_assert(sizeof(AllocationHead) <= alignedHeadSize, "Increase alignedHeadSize to the next power of two.\n");
 
+static const int sizeGroupCount = dsr::allocator_sizeGroupCount;
+// Counters changed from any thread when asking the system for memory, which is already expensive enough to hide atomic operations
+static std::atomic<int64_t> reservedBytes{0};
+static std::atomic<int64_t> peakReservedBytes{0};
+static std::atomic<int64_t> missCounts[sizeGroupCount];
+static std::atomic<int64_t> largeLiveCount{0};
+static std::atomic<int64_t> largeLiveBytes{0};
+
+static void addReservedBytes(int64_t addedBytes) {
+	int64_t newReserved = reservedBytes.fetch_add(addedBytes) + addedBytes;
+	int64_t oldPeak = peakReservedBytes.load();
+	while (newReserved > oldPeak && !peakReservedBytes.compare_exchange_weak(oldPeak, newReserved)) {}
+}
+
 static AllocationHead* createAllocation(size_t contentSize) {
 	//printf("createAllocation head(%li) + %li bytes\n", alignedHeadSize, contentSize);
-	// calloc is faster than malloc for small allocations by not having to fetch old data to the cache
-	AllocationHead* allocation = (AllocationHead*)calloc(alignedHeadSize + contentSize, 1);
+	#ifdef ALLOCATOR_SCRUB
+		// calloc is faster than malloc for small allocations by not having to fetch old data to the cache
+		AllocationHead* allocation = (AllocationHead*)calloc(alignedHeadSize + contentSize, 1);
+	#else
+		AllocationHead* allocation = (AllocationHead*)malloc(alignedHeadSize + contentSize);
+	#endif
 	allocation->nextUnused = nullptr;
 	allocation->contentSize = contentSize;
+	addReservedBytes(contentSize);
 	return allocation;
 }
 
+static void freeAllocation(AllocationHead* allocation) {
+	addReservedBytes(-(int64_t)allocation->contentSize);
+	free(allocation);
+}
 static void* getContent(AllocationHead* head) {
 	return (void*)(((uintptr_t)head) + alignedHeadSize);
 }
@@ -38,6 +73,28 @@ static AllocationHead* getHead(void* content) {
 	return (AllocationHead*)(((uintptr_t)content) - alignedHeadSize);
 }
 
+static int getBufferIndex(size_t contentSize) {
+	if (contentSize <= 16) {
+		return 0;
+	} else if (contentSize <= 32) {
+		return 1;
+	} else if (contentSize <= 64) {
+		return 2;
+	} else if (contentSize <= 128) {
+		return 3;
+	} else if (contentSize <= 256) {
+		return 4;
+	} else if (contentSize <= 512) {
+		return 5;
+	} else if (contentSize <= 1024) {
+		return 6;
+	} else if (contentSize <= 2048) {
+		return 7;
+	} else {
+		return -1;
+	}
+}
+
 // Garbage pile
 struct GarbagePile {
 	AllocationHead* pileHead; // Linked list using nextUnused in AllocationHead
@@ -47,7 +104,7 @@ struct GarbagePile {
 		while (current != nullptr) {
 			// Free and go to the next allocation
 			AllocationHead* next = current->nextUnused;
-			free(current);
+			freeAllocation(current);
 			current = next;
 		}
 	}
@@ -62,19 +119,18 @@ struct GarbagePile {
 			return result;
 		} else {
 			// Create a new allocation
+			missCounts[getBufferIndex(this->fixedBufferSize)]++;
 			return createAllocation(this->fixedBufferSize);
 		}
 	}
 	void recycleAllocation(AllocationHead* unused) {
-		// Clear old data to make debugging easier
-		memset(getContent(unused), 0, this->fixedBufferSize);
 		// Push new allocation to the pile
 		unused->nextUnused = this->pileHead;
 		this->pileHead = unused;
 	}
 };
 
-static GarbagePile garbagePiles[8] = {
+static GarbagePile garbagePiles[sizeGroupCount] = {
   {nullptr, 16},
   {nullptr, 32},
   {nullptr, 64},
@@ -85,59 +141,241 @@ static GarbagePile garbagePiles[8] = {
   {nullptr, 2048}
 };
 
-static int getBufferIndex(size_t contentSize) {
-	if (contentSize <= 16) {
-		return 0;
-	} else if (contentSize <= 32) {
-		return 1;
-	} else if (contentSize <= 64) {
-		return 2;
-	} else if (contentSize <= 128) {
-		return 3;
-	} else if (contentSize <= 256) {
-		return 4;
-	} else if (contentSize <= 512) {
-		return 5;
-	} else if (contentSize <= 1024) {
-		return 6;
-	} else if (contentSize <= 2048) {
-		return 7;
-	} else {
-		return -1;
+// Each thread keeps a few unused allocations per size group, so that most allocations and deletions can be done without locking.
+//   When a thread's cache is empty, a batch of allocations is taken from the global garbage pile in a single locked operation.
+//   When a thread's cache is full, half of it is returned to the global garbage pile in a single locked operation.
+static const int threadCacheLimit = 64;
+static const int threadCacheBatchSize = threadCacheLimit / 2;
+
+// Statistics only written by a single thread at a time, so that they can be counted without atomic read-modify-write operations.
+//   Atomic loads and stores are still used so that other threads can read a snapshot without undefined behavior.
+struct AllocationCounters {
+	// Bytes allocated minus bytes freed, which may be negative for a thread freeing memory from other threads
+	std::atomic<int64_t> liveBytes;
+	std::atomic<int64_t> liveCounts[sizeGroupCount];
+	std::atomic<int64_t> hitCounts[sizeGroupCount];
+};
+static inline void increaseCounter(std::atomic<int64_t>& counter, int64_t addition) {
+	counter.store(counter.load(std::memory_order_relaxed) + addition, std::memory_order_relaxed);
+}
+static void addCounters(AllocationCounters& target, const AllocationCounters& source) {
+	increaseCounter(target.liveBytes, source.liveBytes.load(std::memory_order_relaxed));
+	for (int g = 0; g < sizeGroupCount; g++) {
+		increaseCounter(target.liveCounts[g], source.liveCounts[g].load(std::memory_order_relaxed));
+		increaseCounter(target.hitCounts[g], source.hitCounts[g].load(std::memory_order_relaxed));
 	}
 }
 
-#ifndef DARWIN
-// Not working on Mac for some reason. Locking in operator delete causes infinite recursion into operator new
+// Trivially destructible, so that it can be used until the thread has terminated without depending on destruction order
+struct ThreadCache {
+	AllocationHead* heads[sizeGroupCount];
+	int counts[sizeGroupCount];
+	AllocationCounters counters;
+	// Linked list of all registered thread caches, protected by allocationLock
+	ThreadCache* nextThread;
+	ThreadCache* previousThread;
+	// Set when statistics from the thread are included in allocator_getStatistics
+	bool registered;
+	// Set when the thread has returned its cache, so that late deletions during thread termination go directly to the global piles
+	bool retired;
+};
+static thread_local ThreadCache threadCache = {};
+// Protected by allocationLock
+static ThreadCache* firstThread = nullptr;
+// Statistics from terminated threads and operations after a thread's cache was retired, protected by allocationLock
+static AllocationCounters retiredCounters = {};
 
-void* operator new(size_t contentSize) {
+// Returns up to count allocations from the thread's cache of the size group
+//   Pre-condition: allocationLock is held by the caller
+static void returnFromCache(int bufferIndex, int count) {
+	GarbagePile& pile = garbagePiles[bufferIndex];
+	for (int i = 0; i < count && threadCache.heads[bufferIndex] != nullptr; i++) {
+		AllocationHead* current = threadCache.heads[bufferIndex];
+		threadCache.heads[bufferIndex] = current->nextUnused;
+		threadCache.counts[bufferIndex]--;
+		pile.recycleAllocation(current);
+	}
+}
+
+// Returns the whole cache when the thread terminates
+struct ThreadCacheOwner {
+	~ThreadCacheOwner() {
+		allocationLock.lock();
+			for (int bufferIndex = 0; bufferIndex < sizeGroupCount; bufferIndex++) {
+				returnFromCache(bufferIndex, threadCache.counts[bufferIndex]);
+			}
+			threadCache.retired = true;
+			// Keep the statistics after the thread is gone
+			addCounters(retiredCounters, threadCache.counters);
+			if (threadCache.previousThread != nullptr) {
+				threadCache.previousThread->nextThread = threadCache.nextThread;
+			} else {
+				firstThread = threadCache.nextThread;
+			}
+			if (threadCache.nextThread != nullptr) {
+				threadCache.nextThread->previousThread = threadCache.previousThread;
+			}
+		allocationLock.unlock();
+	}
+};
+static thread_local ThreadCacheOwner threadCacheOwner;
+
+// Called once per thread on the first allocation or deletion
+static void registerThread() {
+	// Register the cache for returning when the thread terminates, before locking in case that registration allocates memory
+	(void)&threadCacheOwner;
 	allocationLock.lock();
-		int bufferIndex = getBufferIndex(contentSize);
-		AllocationHead* head;
-		if (bufferIndex == -1) {
-			head = createAllocation(contentSize);
-			//printf("Allocated %li bytes without a size group\n", contentSize);
-		} else {
-			//printf("Requested at least %li bytes from size group %i\n", contentSize, bufferIndex);
-			head = garbagePiles[bufferIndex].getAllocation();
+		threadCache.registered = true;
+		threadCache.previousThread = nullptr;
+		threadCache.nextThread = firstThread;
+		if (firstThread != nullptr) {
+			firstThread->previousThread = &threadCache;
 		}
+		firstThread = &threadCache;
 	allocationLock.unlock();
-    return getContent(head);
 }
 
-void operator delete(void* content) {
+// Returns the counters to use for statistics from the current thread
+//   Pre-condition: allocationLock is held by the caller if the thread's cache is retired
+static AllocationCounters& getCounters() {
+	return threadCache.retired ? retiredCounters : threadCache.counters;
+}
+
+static AllocationHead* allocateFromGroup(int bufferIndex) {
+	AllocationHead* result = threadCache.heads[bufferIndex];
+	if (result != nullptr) {
+		// Pop from the thread's own cache without locking
+		threadCache.heads[bufferIndex] = result->nextUnused;
+		threadCache.counts[bufferIndex]--;
+		result->nextUnused = nullptr;
+		increaseCounter(threadCache.counters.hitCounts[bufferIndex], 1);
+		increaseCounter(threadCache.counters.liveCounts[bufferIndex], 1);
+		increaseCounter(threadCache.counters.liveBytes, garbagePiles[bufferIndex].fixedBufferSize);
+		return result;
+	}
+	if (!threadCache.registered && !threadCache.retired) {
+		registerThread();
+	}
+	GarbagePile& pile = garbagePiles[bufferIndex];
 	allocationLock.lock();
-		AllocationHead* head = getHead(content);
-		int bufferIndex = getBufferIndex(head->contentSize);
-		if (bufferIndex == -1) {
-			free(head);
-			//printf("Freed memory of size %li without a size group\n", head->contentSize);
+		AllocationCounters& counters = getCounters();
+		if (pile.pileHead != nullptr) {
+			increaseCounter(counters.hitCounts[bufferIndex], 1);
+		}
+		increaseCounter(counters.liveCounts[bufferIndex], 1);
+		increaseCounter(counters.liveBytes, pile.fixedBufferSize);
+		if (threadCache.retired) {
+			result = pile.getAllocation();
 		} else {
-			garbagePiles[bufferIndex].recycleAllocation(head);
-			//printf("Freed memory of size %li from size group %i\n", head->contentSize, bufferIndex);
+			// Take one allocation for the caller and a batch for the cache
+			result = pile.getAllocation();
+			for (int i = 0; i < threadCacheBatchSize && pile.pileHead != nullptr; i++) {
+				AllocationHead* extra = pile.getAllocation();
+				extra->nextUnused = threadCache.heads[bufferIndex];
+				threadCache.heads[bufferIndex] = extra;
+				threadCache.counts[bufferIndex]++;
+			}
 		}
-    allocationLock.unlock();
+	allocationLock.unlock();
+	return result;
+}
+
+static void recycleToGroup(int bufferIndex, AllocationHead* unused) {
+	int64_t fixedBufferSize = garbagePiles[bufferIndex].fixedBufferSize;
+	#ifdef ALLOCATOR_SCRUB
+		// Clear old data to make debugging easier
+		memset(getContent(unused), 0, fixedBufferSize);
+	#endif
+	if (!threadCache.registered && !threadCache.retired) {
+		registerThread();
+	}
+	if (threadCache.retired) {
+		allocationLock.lock();
+			increaseCounter(retiredCounters.liveCounts[bufferIndex], -1);
+			increaseCounter(retiredCounters.liveBytes, -fixedBufferSize);
+			garbagePiles[bufferIndex].recycleAllocation(unused);
+		allocationLock.unlock();
+	} else {
+		increaseCounter(threadCache.counters.liveCounts[bufferIndex], -1);
+		increaseCounter(threadCache.counters.liveBytes, -fixedBufferSize);
+		// Push to the thread's own cache without locking
+		unused->nextUnused = threadCache.heads[bufferIndex];
+		threadCache.heads[bufferIndex] = unused;
+		threadCache.counts[bufferIndex]++;
+		if (threadCache.counts[bufferIndex] > threadCacheLimit) {
+			allocationLock.lock();
+				returnFromCache(bufferIndex, threadCacheBatchSize);
+			allocationLock.unlock();
+		}
+	}
+}
+
+dsr::AllocatorStatistics dsr::allocator_getStatistics() {
+	AllocatorStatistics result;
+	result.available = true;
+	AllocationCounters total = {};
+	allocationLock.lock();
+		addCounters(total, retiredCounters);
+		for (ThreadCache* current = firstThread; current != nullptr; current = current->nextThread) {
+			addCounters(total, current->counters);
+		}
+	allocationLock.unlock();
+	result.largeLiveCount = largeLiveCount.load();
+	result.largeLiveBytes = largeLiveBytes.load();
+	result.liveBytes = total.liveBytes.load() + result.largeLiveBytes;
+	result.reservedBytes = reservedBytes.load();
+	result.peakReservedBytes = peakReservedBytes.load();
+	result.pooledBytes = result.reservedBytes - result.liveBytes;
+	for (int g = 0; g < sizeGroupCount; g++) {
+		AllocatorSizeGroupStatistics& group = result.sizeGroups[g];
+		group.allocationSize = garbagePiles[g].fixedBufferSize;
+		group.liveCount = total.liveCounts[g].load();
+		group.hitCount = total.hitCounts[g].load();
+		group.missCount = missCounts[g].load();
+		// Every allocation ever created in the group is either live or pooled
+		group.pooledCount = group.missCount - group.liveCount;
+	}
+	return result;
+}
+
+#ifndef DARWIN
+// Not working on Mac for some reason. Locking in operator delete causes infinite recursion into operator new
+
+void* operator new(size_t contentSize) {
+	int bufferIndex = getBufferIndex(contentSize);
+	AllocationHead* head;
+	if (bufferIndex == -1) {
+		head = createAllocation(contentSize);
+		largeLiveCount++;
+		largeLiveBytes += contentSize;
+		//printf("Allocated %li bytes without a size group\n", contentSize);
+	} else {
+		//printf("Requested at least %li bytes from size group %i\n", contentSize, bufferIndex);
+		head = allocateFromGroup(bufferIndex);
+	}
+	return getContent(head);
+}
+
+void operator delete(void* content) {
+	AllocationHead* head = getHead(content);
+	int bufferIndex = getBufferIndex(head->contentSize);
+	if (bufferIndex == -1) {
+		largeLiveCount--;
+		largeLiveBytes -= head->contentSize;
+		freeAllocation(head);
+		//printf("Freed memory of size %li without a size group\n", head->contentSize);
+	} else {
+		recycleToGroup(bufferIndex, head);
+		//printf("Freed memory of size %li from size group %i\n", head->contentSize, bufferIndex);
+	}
 }
 #endif
 
+#else
+
+dsr::AllocatorStatistics dsr::allocator_getStatistics() {
+	// Not available when the allocator is disabled
+	return AllocatorStatistics();
+}
+
 #endif
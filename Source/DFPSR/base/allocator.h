@@ -0,0 +1,72 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+
+#ifndef DFPSR_ALLOCATOR
+#define DFPSR_ALLOCATOR
+
+#include <stdint.h>
+
+namespace dsr {
+
+// The number of size groups for small allocations, from 16 to 2048 bytes in powers of two
+static const int allocator_sizeGroupCount = 8;
+
+struct AllocatorSizeGroupStatistics {
+	// The number of bytes given to each allocation in the group
+	int64_t allocationSize = 0;
+	// The number of allocations currently in use
+	int64_t liveCount = 0;
+	// The number of unused allocations kept for reuse, in thread caches or the global garbage pile
+	int64_t pooledCount = 0;
+	// How many times an allocation was reused instead of asking the system for more memory
+	int64_t hitCount = 0;
+	// How many times the system had to be asked for more memory
+	int64_t missCount = 0;
+};
+
+struct AllocatorStatistics {
+	// False if the allocator is disabled and all other values are zero
+	bool available = false;
+	// Bytes currently in use by the application, including larger allocations outside of the size groups
+	int64_t liveBytes = 0;
+	// Bytes kept for reuse in the size groups
+	int64_t pooledBytes = 0;
+	// Bytes currently taken from the system, which is liveBytes + pooledBytes
+	int64_t reservedBytes = 0;
+	// The highest reservedBytes since the application started
+	int64_t peakReservedBytes = 0;
+	// Allocations larger than the biggest size group, which are given directly by the system
+	int64_t largeLiveCount = 0;
+	int64_t largeLiveBytes = 0;
+	AllocatorSizeGroupStatistics sizeGroups[allocator_sizeGroupCount];
+};
+
+// Returns a snapshot of the allocator's memory use, which can be used to find the best pool sizes for a workload.
+//   Counting does not need any locks when allocating, but taking a snapshot has to briefly lock the allocator.
+//   Values may be slightly inconsistent if other threads are allocating at the same time.
+//   Only defined when allocator.cpp is linked into the application.
+AllocatorStatistics allocator_getStatistics();
+
+}
+
+#endif
@@ -969,6 +969,24 @@
 			#endif
 		#endif
 	}
+	// Returns all bits set in lanes where left is less than or equal to right and no bits set in the other lanes
+	//   Lanes containing NaN compare as false, just like scalar comparisons
+	inline U32x4 lessOrEqualMask(const F32x4& left, const F32x4& right) {
+		#ifdef USE_SSE2
+			return U32x4(_mm_castps_si128(_mm_cmple_ps(left.v, right.v)));
+		#else
+			#ifdef USE_NEON
+				return U32x4(vcleq_f32(left.v, right.v));
+			#else
+				return U32x4(
+				  left.emulated[0] <= right.emulated[0] ? 0xFFFFFFFFu : 0u,
+				  left.emulated[1] <= right.emulated[1] ? 0xFFFFFFFFu : 0u,
+				  left.emulated[2] <= right.emulated[2] ? 0xFFFFFFFFu : 0u,
+				  left.emulated[3] <= right.emulated[3] ? 0xFFFFFFFFu : 0u
+				);
+			#endif
+		#endif
+	}
 
 	union U16x8 {
 		#ifdef USE_BASIC_SIMD
@@ -1195,6 +1213,20 @@
 			);
 		#endif
 	}
+	inline U16x8 operator>>(const U16x8& left, uint32_t bitOffset) {
+		#ifdef USE_SSE2
+			return U16x8(_mm_srli_epi16(left.v, bitOffset));
+		#else
+			#ifdef USE_NEON
+				return U16x8(vshlq_u16(left.v, vdupq_n_s16(-(int16_t)bitOffset)));
+			#else
+				return U16x8(
+				  left.emulated[0] >> bitOffset, left.emulated[1] >> bitOffset, left.emulated[2] >> bitOffset, left.emulated[3] >> bitOffset,
+				  left.emulated[4] >> bitOffset, left.emulated[5] >> bitOffset, left.emulated[6] >> bitOffset, left.emulated[7] >> bitOffset
+				);
+			#endif
+		#endif
+	}
 
 	union U8x16 {
 		#ifdef USE_BASIC_SIMD
@@ -22,12 +22,16 @@
 //    distribution.
 
 #include "threading.h"
+#include "../api/stringAPI.h"
 
 // Requires -pthread for linking
-#include <future>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <vector>
+#include <algorithm>
+#include <memory>
 
 namespace dsr {
 
@@ -35,15 +39,235 @@ namespace dsr {
 //   If your application still crashes when using a single thread, it's probably not a concurrency problem
 //#define DISABLE_MULTI_THREADING
 
-// Prevent doing other multi-threaded work at the same time
-//   As a side effect, this makes it safe to use global variables to prevent unsafe use of stack memory
-static std::mutex workLock, getTaskLock;
-static std::atomic<int> nextJobIndex{0};
+// A range of job indices owned by one worker, packed into 64 bits so that it can be updated with a single compare and swap.
+//   The owner takes one job at a time from the front, while idle workers steal the back half.
+//   Indices are only consumed once per batch, so a range can never return to an earlier state and ABA is not a problem.
+struct WorkerQueue {
+	std::atomic<uint64_t> range{0};
+	// Keep each queue on its own cache line
+	char padding[64 - sizeof(std::atomic<uint64_t>)];
+	static uint64_t pack(int first, int end) {
+		return ((uint64_t)(uint32_t)end << 32) | (uint64_t)(uint32_t)first;
+	}
+	static int getFirst(uint64_t packed) { return (int)(uint32_t)packed; }
+	static int getEnd(uint64_t packed) { return (int)(uint32_t)(packed >> 32); }
+	void assign(int first, int end) {
+		this->range.store(pack(first, end));
+	}
+	// Returns true and writes the job index if the queue was not empty
+	bool takeFront(int& index) {
+		uint64_t old = this->range.load();
+		while (true) {
+			int first = getFirst(old);
+			int end = getEnd(old);
+			if (first >= end) {
+				return false;
+			} else if (this->range.compare_exchange_weak(old, pack(first + 1, end))) {
+				index = first;
+				return true;
+			}
+		}
+	}
+	// Returns true and writes the stolen interval if the queue was not empty
+	bool stealBack(int& stolenFirst, int& stolenEnd) {
+		uint64_t old = this->range.load();
+		while (true) {
+			int first = getFirst(old);
+			int end = getEnd(old);
+			if (first >= end) {
+				return false;
+			}
+			// Leave the first half to the owner, which will take everything if only one job remains
+			int middle = first + (end - first) / 2;
+			if (this->range.compare_exchange_weak(old, pack(first, middle))) {
+				stolenFirst = middle;
+				stolenEnd = end;
+				return true;
+			}
+		}
+	}
+	int remaining() const {
+		uint64_t current = this->range.load();
+		return getEnd(current) - getFirst(current);
+	}
+};
+
+// A batch of jobs submitted by one thread, living on the submitting thread's stack until all participants have left.
+//   Every participant claims a slot with its own range of job indices and steals from the fullest range when running out of work.
+struct Batch {
+	const std::function<void(int jobIndex)>& job;
+	// One queue per slot, where slot 0 belongs to the thread that submitted the batch
+	std::vector<WorkerQueue> queues;
+	// Only modified while holding the pool's lock
+	int claimedSlots = 1;
+	int helpingThreads = 0;
+	Batch(const std::function<void(int jobIndex)>& job, int jobCount, int slotCount)
+	: job(job), queues(slotCount) {
+		// Give each slot an even share of the jobs
+		int givenJobs = 0;
+		for (int s = 0; s < slotCount; s++) {
+			int remainingSlots = slotCount - s;
+			int shareSize = (jobCount - givenJobs) / remainingSlots;
+			this->queues[s].assign(givenJobs, givenJobs + shareSize);
+			givenJobs += shareSize;
+		}
+	}
+	bool hasRemainingJobs() const {
+		for (int q = 0; q < (int)this->queues.size(); q++) {
+			if (this->queues[q].remaining() > 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+	// Steal from the queue with the most remaining jobs, so that large ranges are subdivided before small ones
+	bool steal(int slot) {
+		while (true) {
+			int victimIndex = -1;
+			int mostRemaining = 0;
+			for (int q = 0; q < (int)this->queues.size(); q++) {
+				if (q != slot) {
+					int remaining = this->queues[q].remaining();
+					if (remaining > mostRemaining) {
+						mostRemaining = remaining;
+						victimIndex = q;
+					}
+				}
+			}
+			if (victimIndex == -1) {
+				// Nothing left to steal
+				return false;
+			}
+			int stolenFirst, stolenEnd;
+			if (this->queues[victimIndex].stealBack(stolenFirst, stolenEnd)) {
+				this->queues[slot].assign(stolenFirst, stolenEnd);
+				return true;
+			}
+			// The victim ran out of work before we could steal, so look again
+		}
+	}
+	// Returns when there are no more jobs to take, while other participants may still be executing their last jobs
+	void work(int slot) {
+		WorkerQueue& ownQueue = this->queues[slot];
+		int jobIndex;
+		while (true) {
+			if (ownQueue.takeFront(jobIndex)) {
+				this->job(jobIndex);
+			} else if (!this->steal(slot)) {
+				break;
+			}
+		}
+	}
+};
+
+// A pool of helper threads that are started once and then parked until a batch of jobs arrives.
+//   Starting and joining threads for every call was a fixed cost of several milliseconds per frame on many cores.
+//   The calling thread works on its own batch together with the helpers, so a pool of zero helpers is still valid.
+//   Any number of threads may submit batches at the same time, including jobs submitting nested batches.
+//     Idle helpers join the open batch with the most remaining work.
+//     A submitter only waits for jobs within its own batch, which always make progress because the submitter keeps
+//     taking jobs until none are left, so nested batches cannot deadlock.
+class ThreadPool {
+private:
+	std::vector<std::thread> helpers;
+	std::mutex poolLock;
+	std::condition_variable wakeHelpers, helperLeft;
+	// Batches that helpers may join, only accessed while holding poolLock
+	std::vector<Batch*> openBatches;
+	bool terminating = false;
+	// Pre-condition: poolLock is held by the caller
+	Batch* findOpenBatch() {
+		Batch* result = nullptr;
+		int leastHelpers = 0;
+		for (int b = 0; b < (int)this->openBatches.size(); b++) {
+			Batch* batch = this->openBatches[b];
+			if (batch->claimedSlots < (int)batch->queues.size() && batch->hasRemainingJobs()
+			 && (result == nullptr || batch->helpingThreads < leastHelpers)) {
+				result = batch;
+				leastHelpers = batch->helpingThreads;
+			}
+		}
+		return result;
+	}
+	void helperLoop() {
+		while (true) {
+			Batch* batch = nullptr;
+			int slot;
+			{
+				std::unique_lock<std::mutex> lock(this->poolLock);
+				this->wakeHelpers.wait(lock, [this, &batch]() {
+					return this->terminating || (batch = this->findOpenBatch()) != nullptr;
+				});
+				if (this->terminating) {
+					return;
+				}
+				slot = batch->claimedSlots;
+				batch->claimedSlots++;
+				batch->helpingThreads++;
+			}
+			batch->work(slot);
+			{
+				std::unique_lock<std::mutex> lock(this->poolLock);
+				batch->helpingThreads--;
+				if (batch->helpingThreads == 0) {
+					this->helperLeft.notify_all();
+				}
+			}
+		}
+	}
+public:
+	ThreadPool() {
+		// Leave one hardware thread for the caller
+		int helperCount = (int)std::thread::hardware_concurrency() - 1;
+		for (int h = 0; h < helperCount; h++) {
+			this->helpers.push_back(std::thread([this]() { this->helperLoop(); }));
+		}
+	}
+	~ThreadPool() {
+		{
+			std::unique_lock<std::mutex> lock(this->poolLock);
+			this->terminating = true;
+		}
+		this->wakeHelpers.notify_all();
+		for (int h = 0; h < (int)this->helpers.size(); h++) {
+			this->helpers[h].join();
+		}
+	}
+	// Safe to call from any thread, including from inside of a job
+	void execute(const std::function<void(int jobIndex)>& job, int jobCount) {
+		if (this->helpers.size() == 0) {
+			for (int j = 0; j < jobCount; j++) {
+				job(j);
+			}
+			return;
+		}
+		// At most every helper and the submitting thread can work on the same batch
+		Batch batch(job, jobCount, this->helpers.size() + 1);
+		{
+			std::unique_lock<std::mutex> lock(this->poolLock);
+			this->openBatches.push_back(&batch);
+		}
+		this->wakeHelpers.notify_all();
+		// Perform the same work on the calling thread
+		batch.work(0);
+		// Close the batch and wait for all helpers to leave before it goes out of scope
+		std::unique_lock<std::mutex> lock(this->poolLock);
+		for (int b = 0; b < (int)this->openBatches.size(); b++) {
+			if (this->openBatches[b] == &batch) {
+				this->openBatches.erase(this->openBatches.begin() + b);
+				break;
+			}
+		}
+		this->helperLeft.wait(lock, [&batch]() { return batch.helpingThreads == 0; });
+	}
+};
+
+static ThreadPool& getThreadPool() {
+	// Created on first use so that the helpers are not started by applications that never use multi-threading
+	static ThreadPool pool;
+	return pool;
+}
 
-// TODO: This method really needs a thread pool for starting jobs faster,
-//       but third-party libraries often use low-level platform specific solutions.
-// TODO: Let each worker have one future doing scheduling on it's own to prevent stalling on a scheduling main thread.
-//       When a worker is done with a task, it will use a mutex protected volatile variable to pick the next task from the queue.
 void threadedWorkFromArray(std::function<void()>* jobs, int jobCount) {
 	#ifdef DISABLE_MULTI_THREADING
 		// Reference implementation
@@ -56,41 +280,26 @@ void threadedWorkFromArray(std::function<void()>* jobs, int jobCount) {
 		} else if (jobCount == 1) {
 			jobs[0]();
 		} else {
-			workLock.lock();
-				nextJobIndex = 0;
-				// Multi-threaded work loop
-				int workerCount = std::min((int)std::thread::hardware_concurrency() - 1, jobCount); // All used threads
-				int helperCount = workerCount - 1; // Excluding the main thread
-				std::function<void()> workers[workerCount];
-				std::future<void> helpers[helperCount];
-				for (int w = 0; w < workerCount; w++) {
-					workers[w] = [jobs, jobCount]() {
-						while (true) {
-							getTaskLock.lock();
-							int taskIndex = nextJobIndex;
-							nextJobIndex++;
-							getTaskLock.unlock();
-							if (taskIndex < jobCount) {
-								jobs[taskIndex]();
-							} else {
-								break;
-							}
-						}
-					};
-				}
-				// Start working in the helper threads
-				for (int h = 0; h < helperCount; h++) {
-					helpers[h] = std::async(std::launch::async, workers[h]);
-				}
-				// Perform the same work on the main thread
-				workers[workerCount - 1]();
-				// Wait for all helpers to complete their work once all tasks have been handed out
-				for (int h = 0; h < helperCount; h++) {
-					if (helpers[h].valid()) {
-						helpers[h].wait();
-					}
-				}
-			workLock.unlock();
+			getThreadPool().execute([jobs](int jobIndex) {
+				jobs[jobIndex]();
+			}, jobCount);
+		}
+	#endif
+}
+
+void threadedWorkByIndex(const std::function<void(int jobIndex)>& job, int jobCount) {
+	#ifdef DISABLE_MULTI_THREADING
+		// Reference implementation
+		for (int j = 0; j < jobCount; j++) {
+			job(j);
+		}
+	#else
+		if (jobCount <= 0) {
+			return;
+		} else if (jobCount == 1) {
+			job(0);
+		} else {
+			getThreadPool().execute(job, jobCount);
 		}
 	#endif
 }
@@ -100,26 +309,145 @@ void threadedWorkFromList(List<std::function<void()>> jobs) {
 	jobs.clear();
 }
 
-void threadedSplit(int startIndex, int stopIndex, std::function<void(int startIndex, int stopIndex)> task, int minimumJobSize, int jobsPerThread) {
-	int totalCount = stopIndex - startIndex;
+void TaskGroup::run(const std::function<void()>& task) {
+	this->tasks.push(task);
+}
+
+void TaskGroup::wait() {
+	// Take the tasks out of the group, so that it can be reused after waiting
+	List<std::function<void()>> currentTasks = std::move(this->tasks);
+	this->tasks.clear();
+	if (currentTasks.length() > 0) {
+		threadedWorkFromArray(&currentTasks[0], currentTasks.length());
+	}
+}
+
+TaskGroup::~TaskGroup() {
+	this->wait();
+}
+
+int TaskGraph::addTask(const std::function<void()>& task, const List<TaskResource>& inputs, const List<TaskResource>& outputs) {
+	int newIndex = this->nodes.length();
+	this->nodes.pushConstruct(task, inputs, outputs);
+	Node& newNode = this->nodes[newIndex];
+	for (int t = 0; t < newIndex; t++) {
+		Node& earlierNode = this->nodes[t];
+		bool conflict = false;
+		for (int o = 0; o < earlierNode.outputs.length() && !conflict; o++) {
+			// Read after write and write after write
+			for (int i = 0; i < newNode.inputs.length() && !conflict; i++) {
+				conflict = earlierNode.outputs[o].overlaps(newNode.inputs[i]);
+			}
+			for (int i = 0; i < newNode.outputs.length() && !conflict; i++) {
+				conflict = earlierNode.outputs[o].overlaps(newNode.outputs[i]);
+			}
+		}
+		// Write after read
+		for (int i = 0; i < earlierNode.inputs.length() && !conflict; i++) {
+			for (int o = 0; o < newNode.outputs.length() && !conflict; o++) {
+				conflict = earlierNode.inputs[i].overlaps(newNode.outputs[o]);
+			}
+		}
+		if (conflict) {
+			this->addDependency(t, newIndex);
+		}
+	}
+	return newIndex;
+}
+
+void TaskGraph::addDependency(int earlierTaskIndex, int laterTaskIndex) {
+	if (earlierTaskIndex < 0 || laterTaskIndex >= this->nodes.length() || earlierTaskIndex >= laterTaskIndex) {
+		throwError(U"TaskGraph::addDependency requires 0 <= earlierTaskIndex < laterTaskIndex < task count!\n");
+	}
+	this->nodes[earlierTaskIndex].laterTasks.push(laterTaskIndex);
+	this->nodes[laterTaskIndex].dependencyCount++;
+}
+
+// Runs the task and then continues with the tasks that became ready when it was done
+void TaskGraph::runTask(std::atomic<int>* remainingDependencies, int taskIndex) {
+	while (true) {
+		this->nodes[taskIndex].task();
+		List<int> readyTasks;
+		const List<int>& laterTasks = this->nodes[taskIndex].laterTasks;
+		for (int l = 0; l < laterTasks.length(); l++) {
+			// Whoever completes the last dependency is responsible for starting the task
+			if (remainingDependencies[laterTasks[l]].fetch_sub(1) == 1) {
+				readyTasks.push(laterTasks[l]);
+			}
+		}
+		if (readyTasks.length() == 1) {
+			// Continue on the same thread without creating a new batch
+			taskIndex = readyTasks[0];
+		} else {
+			this->runTasks(remainingDependencies, readyTasks);
+			return;
+		}
+	}
+}
+
+void TaskGraph::runTasks(std::atomic<int>* remainingDependencies, const List<int>& readyTasks) {
+	if (readyTasks.length() == 1) {
+		this->runTask(remainingDependencies, readyTasks[0]);
+	} else if (readyTasks.length() > 1) {
+		#ifdef DISABLE_MULTI_THREADING
+			for (int r = 0; r < readyTasks.length(); r++) {
+				this->runTask(remainingDependencies, readyTasks[r]);
+			}
+		#else
+			getThreadPool().execute([this, remainingDependencies, &readyTasks](int jobIndex) {
+				this->runTask(remainingDependencies, readyTasks[jobIndex]);
+			}, readyTasks.length());
+		#endif
+	}
+}
+
+void TaskGraph::execute() {
+	int taskCount = this->nodes.length();
+	std::unique_ptr<std::atomic<int>[]> remainingDependencies(new std::atomic<int>[taskCount]);
+	List<int> readyTasks;
+	for (int t = 0; t < taskCount; t++) {
+		remainingDependencies[t] = this->nodes[t].dependencyCount;
+		if (this->nodes[t].dependencyCount == 0) {
+			readyTasks.push(t);
+		}
+	}
+	this->runTasks(remainingDependencies.get(), readyTasks);
+	this->nodes.clear();
+}
+
+int impl_getSplitJobCount(int totalCount, int minimumJobSize, int jobsPerThread) {
+	if (minimumJobSize < 1) { minimumJobSize = 1; }
 	int maxJobs = totalCount / minimumJobSize;
 	int jobCount = std::thread::hardware_concurrency() * jobsPerThread;
 	if (jobCount > maxJobs) { jobCount = maxJobs; }
 	if (jobCount < 1) { jobCount = 1; }
+	return jobCount;
+}
+
+void impl_getSplitBoundaries(int *boundaries, int startIndex, int stopIndex, int jobCount) {
+	int givenRow = startIndex;
+	boundaries[0] = givenRow;
+	for (int s = 0; s < jobCount; s++) {
+		int remainingJobs = jobCount - s;
+		int remainingRows = stopIndex - givenRow;
+		givenRow = givenRow + remainingRows / remainingJobs;
+		boundaries[s + 1] = givenRow;
+	}
+}
+
+void threadedSplit(int startIndex, int stopIndex, std::function<void(int startIndex, int stopIndex)> task, int minimumJobSize, int jobsPerThread) {
+	int jobCount = impl_getSplitJobCount(stopIndex - startIndex, minimumJobSize, jobsPerThread);
 	if (jobCount == 1) {
 		// Too little work for multi-threading
 		task(startIndex, stopIndex);
 	} else {
 		// Use multiple threads
 		std::function<void()> jobs[jobCount];
-		int givenRow = startIndex;
+		int boundaries[jobCount + 1];
+		impl_getSplitBoundaries(boundaries, startIndex, stopIndex, jobCount);
 		for (int s = 0; s < jobCount; s++) {
-			int remainingJobs = jobCount - s;
-			int remainingRows = stopIndex - givenRow;
-			int y1 = givenRow; // Inclusive
-			int taskSize = remainingRows / remainingJobs;
-			givenRow = givenRow + taskSize;
-			int y2 = givenRow; // Exclusive
+			int y1 = boundaries[s]; // Inclusive
+			int y2 = boundaries[s + 1]; // Exclusive
 			jobs[s] = [task, y1, y2]() {
 				task(y1, y2);
 			};
@@ -133,24 +461,17 @@ void threadedSplit_disabled(int startIndex, int stopIndex, std::function<void(in
 }
 
 void threadedSplit(const IRect& bound, std::function<void(const IRect& bound)> task, int minimumRowsPerJob, int jobsPerThread) {
-	int maxJobs = bound.height() / minimumRowsPerJob;
-	int jobCount = std::thread::hardware_concurrency() * jobsPerThread;
-	if (jobCount > maxJobs) { jobCount = maxJobs; }
-	if (jobCount < 1) { jobCount = 1; }
+	int jobCount = impl_getSplitJobCount(bound.height(), minimumRowsPerJob, jobsPerThread);
 	if (jobCount == 1) {
 		// Too little work for multi-threading
 		task(bound);
 	} else {
 		// Use multiple threads
 		std::function<void()> jobs[jobCount];
-		int givenRow = bound.top();
+		int boundaries[jobCount + 1];
+		impl_getSplitBoundaries(boundaries, bound.top(), bound.bottom(), jobCount);
 		for (int s = 0; s < jobCount; s++) {
-			int remainingJobs = jobCount - s;
-			int remainingRows = bound.bottom() - givenRow;
-			int y1 = givenRow;
-			int taskSize = remainingRows / remainingJobs;
-			givenRow = givenRow + taskSize;
-			IRect subBound = IRect(bound.left(), y1, bound.width(), taskSize);
+			IRect subBound = IRect(bound.left(), boundaries[s], bound.width(), boundaries[s + 1] - boundaries[s]);
 			jobs[s] = [task, subBound]() {
 				task(subBound);
 			};
@@ -163,5 +484,33 @@ void threadedSplit_disabled(const IRect& bound, std::function<void(const IRect&
 	task(bound);
 }
 
+void threadedSplit_adaptive(int startIndex, int stopIndex, std::function<void(int startIndex, int stopIndex)> task, int grainSize) {
+	if (grainSize < 1) { grainSize = 1; }
+	#ifdef DISABLE_MULTI_THREADING
+		task(startIndex, stopIndex);
+	#else
+		int totalCount = stopIndex - startIndex;
+		int grainCount = (totalCount + grainSize - 1) / grainSize;
+		if (grainCount <= 1) {
+			// Too little work for multi-threading
+			task(startIndex, stopIndex);
+		} else {
+			// Each grain is only cut out of a worker's range when it is about to be processed
+			getThreadPool().execute([task, startIndex, stopIndex, grainSize](int grainIndex) {
+				int first = startIndex + grainIndex * grainSize;
+				int end = std::min(first + grainSize, stopIndex);
+				task(first, end);
+			}, grainCount);
+		}
+	#endif
+}
+
+void threadedSplit_adaptive(const IRect& bound, std::function<void(const IRect& bound)> task, int rowsPerGrain) {
+	threadedSplit_adaptive(bound.top(), bound.bottom(), [task, bound](int startRow, int stopRow) {
+		task(IRect(bound.left(), startRow, bound.width(), stopRow - startRow));
+	}, rowsPerGrain);
 }
 
+}
+
+
@@ -27,16 +27,109 @@
 #include "../../DFPSR/collection/List.h"
 #include "../../DFPSR/math/IRect.h"
 #include <functional>
+#include <atomic>
+#include <memory>
 
 namespace dsr {
 
+// The threading functions are safe to call from any thread, including from inside of jobs and tasks running on other threads.
+//   Independent callers may run parallel work at the same time, and a job may spawn its own parallel sub-work.
+//   Each call returns when all of its own work is done, without waiting for work submitted by other callers.
+
 // Executes every function in the array of jobs from jobs[0] to jobs[jobCount - 1].
 void threadedWorkFromArray(std::function<void()>* jobs, int jobCount);
 
+// Calls job with every index from 0 to jobCount - 1.
+//   Threads running out of work steal indices from busy threads, so jobs of uneven cost are balanced automatically.
+//   Useful for processing independent bins of work, such as screen tiles, without creating a function for each job.
+void threadedWorkByIndex(const std::function<void(int jobIndex)>& job, int jobCount);
+
 // Executes every function in the list of jobs.
 //   Also clears the list when done.
 void threadedWorkFromList(List<std::function<void()>> jobs);
 
+// Fork and join of independent tasks, which may in turn use task groups or any other parallel function.
+//   Tasks added with run are executed in parallel when wait is called, which returns once every task is done.
+//   Example:
+//     TaskGroup group;
+//     for (int s = 0; s < 6; s++) {
+//       group.run([s]() { renderSide(s); });
+//     }
+//     group.wait();
+//   Only call run and wait from the thread owning the group.
+//   Tasks that are still pending when the group is destroyed will be executed by the destructor.
+class TaskGroup {
+private:
+	List<std::function<void()>> tasks;
+public:
+	TaskGroup() {}
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+	~TaskGroup();
+	// Adds a task to be executed in the next call to wait
+	void run(const std::function<void()>& task);
+	// Executes all added tasks in parallel and returns when they are done
+	void wait();
+};
+
+// Something that tasks in a TaskGraph read from or write to.
+//   Identified by any address, such as the image or object being modified, or the address of a variable used as a token.
+//   An optional region allows tasks writing to separate parts of the same image to run at the same time.
+//   Two resources overlap if they have the same identity and either covers the whole resource or their regions overlap.
+struct TaskResource {
+	const void* identity;
+	IRect region;
+	bool wholeResource;
+	explicit TaskResource(const void* identity)
+	: identity(identity), wholeResource(true) {}
+	TaskResource(const void* identity, const IRect& region)
+	: identity(identity), region(region), wholeResource(false) {}
+	bool overlaps(const TaskResource& other) const {
+		return this->identity == other.identity && (this->wholeResource || other.wholeResource || IRect::overlaps(this->region, other.region));
+	}
+};
+
+// A graph of tasks for pipelines where stages depend on results from earlier stages.
+//   Each task declares which resources it reads and writes, and a task waits only for earlier tasks that it conflicts with:
+//     * Reading what an earlier task writes.
+//     * Writing what an earlier task reads or writes.
+//   Independent tasks run in parallel without any full barrier between them,
+//     and a task is started by the thread completing its last dependency.
+//   Tasks may use any other parallel function internally.
+//   Example:
+//     TaskGraph graph;
+//     graph.addTask([]() { renderShadows(shadowMap); }, {}, {TaskResource(&shadowMap)});
+//     graph.addTask([]() { drawScene(diffuse); }, {}, {TaskResource(&diffuse)});
+//     graph.addTask([]() { applyLight(shadowMap, diffuse); }, {TaskResource(&shadowMap)}, {TaskResource(&diffuse)});
+//     graph.execute();
+class TaskGraph {
+private:
+	struct Node {
+		std::function<void()> task;
+		List<TaskResource> inputs, outputs;
+		List<int> laterTasks; // Tasks that can not start before this task is done
+		int dependencyCount = 0;
+		Node(const std::function<void()>& task, const List<TaskResource>& inputs, const List<TaskResource>& outputs)
+		: task(task), inputs(inputs), outputs(outputs) {}
+	};
+	List<Node> nodes;
+	// Runs the task and then continues with the tasks that became ready when it was done
+	void runTask(std::atomic<int>* remainingDependencies, int taskIndex);
+	// Runs the ready tasks in parallel
+	void runTasks(std::atomic<int>* remainingDependencies, const List<int>& readyTasks);
+public:
+	// Adds a task after the previously added tasks and returns its index.
+	//   Dependencies on earlier tasks are found from the overlaps between resources.
+	int addTask(const std::function<void()>& task, const List<TaskResource>& inputs, const List<TaskResource>& outputs);
+	// Makes laterTaskIndex wait for earlierTaskIndex, for dependencies that are not described by resources.
+	//   Pre-condition: earlierTaskIndex < laterTaskIndex, so that there can be no cycles.
+	void addDependency(int earlierTaskIndex, int laterTaskIndex);
+	int getTaskCount() const { return this->nodes.length(); }
+	// Executes all tasks and returns when all are done.
+	//   Post-condition: The graph is empty and can be used for new tasks.
+	void execute();
+};
+
 // Calling the given function with sub-sets of the interval using multiple threads in parallel.
 //   Useful when you have lots of tiny jobs that can be grouped together into larger jobs.
 //     Otherwise the time to start a thread may exceed the cost of the computation.
@@ -61,6 +154,67 @@ void threadedSplit(const IRect& bound, std::function<void(const IRect& bound)> t
 // Use as a place-holder if you want to disable multi-threading but easily turn it on and off for comparing performance
 void threadedSplit_disabled(const IRect& bound, std::function<void(const IRect& bound)> task);
 
+// Adaptive versions of threadedSplit for uneven workloads, where some parts of the interval are much heavier than others.
+//   Instead of dividing the interval into a fixed number of jobs in advance, each thread starts with an equal share
+//   and processes it grainSize indices at a time, while threads running out of work steal half of the largest remaining share.
+//   The task may therefore be called many times with intervals of up to grainSize indices.
+//   Use a grainSize large enough to hide the cost of calling task, but small enough to let heavy regions be shared.
+//   The same warnings as for threadedSplit apply.
+void threadedSplit_adaptive(int startIndex, int stopIndex, std::function<void(int startIndex, int stopIndex)> task, int grainSize = 16);
+// Each call to task gets a sub-bound of up to rowsPerGrain rows with the same left and right sides as bound.
+void threadedSplit_adaptive(const IRect& bound, std::function<void(const IRect& bound)> task, int rowsPerGrain = 4);
+
+// Internal helpers for threadedSplit and the threadedReduce templates, do not call these yourself.
+//   Returns the number of jobs that threadedSplit would use for totalCount indices.
+int impl_getSplitJobCount(int totalCount, int minimumJobSize, int jobsPerThread);
+//   Writes the jobCount + 1 boundaries of the sub-intervals that threadedSplit gives to each job into boundaries.
+//   Each job gets the remaining indices divided by the remaining jobs, so the last jobs get any extra indices.
+void impl_getSplitBoundaries(int *boundaries, int startIndex, int stopIndex, int jobCount);
+
+// Parallel reduction over an interval, splitting it the same way as threadedSplit.
+//   map(startIndex, stopIndex) returns the partial result for a sub-interval, computed locally by the thread calling it.
+//   combine(a, b) merges two partial results, and must be associative with identity as the neutral element.
+//   Each job writes its partial result to its own element, so no atomics or locks are needed,
+//   and the partial results are combined in the order of the interval to make floating-point results repeatable.
+//   T must be default constructible and assignable, and may be bool for any and all reductions.
+//   Example:
+//     int64_t sum = threadedReduce<int64_t>(0, length, 0,
+//       [&data](int startIndex, int stopIndex) { int64_t sum = 0; for (int i = startIndex; i < stopIndex; i++) sum += data[i]; return sum; },
+//       [](int64_t a, int64_t b) { return a + b; });
+template <typename T, typename MAP, typename COMBINE>
+T threadedReduce(int startIndex, int stopIndex, const T& identity, const MAP& map, const COMBINE& combine, int minimumJobSize = 128, int jobsPerThread = 2) {
+	int jobCount = impl_getSplitJobCount(stopIndex - startIndex, minimumJobSize, jobsPerThread);
+	if (jobCount <= 1) {
+		// Too little work for multi-threading
+		return (startIndex < stopIndex) ? combine(identity, map(startIndex, stopIndex)) : identity;
+	} else {
+		// Not using List, because std::vector<bool> packs bits without any element to write to
+		std::unique_ptr<T[]> partialResults(new T[jobCount]);
+		for (int j = 0; j < jobCount; j++) {
+			partialResults[j] = identity;
+		}
+		std::unique_ptr<int[]> boundaries(new int[jobCount + 1]);
+		impl_getSplitBoundaries(boundaries.get(), startIndex, stopIndex, jobCount);
+		T *partialData = partialResults.get();
+		const int *boundaryData = boundaries.get();
+		threadedWorkByIndex([partialData, boundaryData, &map](int jobIndex) {
+			partialData[jobIndex] = map(boundaryData[jobIndex], boundaryData[jobIndex + 1]);
+		}, jobCount);
+		T result = identity;
+		for (int j = 0; j < jobCount; j++) {
+			result = combine(result, partialResults[j]);
+		}
+		return result;
+	}
+}
+// A more convenient version for images, where map gets sub-bounds with the same left and right sides as bound.
+template <typename T, typename MAP, typename COMBINE>
+T threadedReduce(const IRect& bound, const T& identity, const MAP& map, const COMBINE& combine, int minimumRowsPerJob = 128, int jobsPerThread = 2) {
+	return threadedReduce<T>(bound.top(), bound.bottom(), identity, [&map, &bound](int startRow, int stopRow) {
+		return map(IRect(bound.left(), startRow, bound.width(), stopRow - startRow));
+	}, combine, minimumRowsPerJob, jobsPerThread);
+}
+
 }
 
 #endif
@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include <vector>
 #include <algorithm>
+#include <initializer_list>
 
 namespace dsr {
 
@@ -50,6 +51,8 @@ public:
 	// Clonable by default!
 	//   Pass by reference if you don't want to lose your changes and waste time duplicating memory
 	List(const List& source) : backend(std::vector<T>(source.backend.begin(), source.backend.end())) {}
+	// Constructor from a list of elements within curly brackets, such as List<int>({1, 2, 3})
+	List(std::initializer_list<T> elements) : backend(elements) {}
 	// Post-condition: Returns the number of elements in the array list
 	int64_t length() const {
 		return (int64_t)this->backend.size();
@@ -150,9 +150,10 @@ inline bool isUniformByteU16(uint16_t value) {
 }
 
 // A special rounding used for triangle rasterization
+//   Values outside of the range where every integer can be represented in a float are replaced by zero.
 inline int64_t safeRoundInt64(float value) {
 	int64_t result = floor(value);
-	if (value <= -1048576.0f || value >= 1048576.0f) { result = 0; }
+	if (value <= -16777216.0f || value >= 16777216.0f) { result = 0; }
 	if (value < 0.0f) { result--; }
 	return result;
 }
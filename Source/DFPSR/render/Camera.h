@@ -31,6 +31,7 @@
 #include "../math/FPlane3D.h"
 #include "../math/Transform3D.h"
 #include "../math/scalar.h"
+#include "../api/stringAPI.h"
 #include "constants.h"
 #include "ProjectedPoint.h"
 #include <limits>
@@ -76,44 +77,91 @@ public:
 // How much is the image region magnified for skipping entire triangles.
 //   A small margin is needed to prevent missing pixels from rounding errors along the borders in high image resolutions.
 static const float cullRatio = 1.0001f;
-// How much is the image region magnified for clipping triangles.
-//   The larger you make the clip region, the less triangles you have to apply clipping to.
-//   The triangle rasterization can handle clipping triangles in integer coordinates,
-//     but there are limits to how large those integers can become before overflowing.
-static const float clipRatio = 2.0f;
+// The guard band is how many pixels from the image's center that triangles can reach before the sides are clipped as polygons.
+//   This is measured from the center rather than the edges, because getClipRatio scales the half-size of the image,
+//     so the margin outside of the image edges is guardBandPixels minus half of the image size along each dimension.
+//   Triangles crossing the image edges within the guard band are clipped by the integer rasterizer's clip bound instead,
+//     so that only triangles reaching far outside of the image or through the near and far planes need polygon clipping.
+//   The guard band is limited by the sub-pixel coordinates given by safeRoundInt64,
+//     which must stay within the 24 bits that can be represented exactly in a float.
+static const float guardBandPixels = 16384.0f;
+// The clip region is never smaller than twice the image, even for huge images.
+static const float minimumClipRatio = 2.0f;
+// How much is the image region magnified for clipping triangles along an image dimension of imageSize pixels.
+inline float getClipRatio(float imageSize) {
+	float ratio = imageSize > 0.0f ? (guardBandPixels * 2.0f) / imageSize : minimumClipRatio;
+	return ratio > minimumClipRatio ? ratio : minimumClipRatio;
+}
 // To prevent division by zero, a near clipping distance is slightly above zero to
 //   clip triangles in 3D camera space before projecting the coordinates to the target image.
 static const float defaultNearClip = 0.01f;
 static const float defaultFarClip = 1000.0f;
 
+// Bit masks for the outcodes returned by Camera::getOutcode
+static const int clipOutcodeOffset = 8;
+static const uint32_t cullOutcodeMask = 0x000000FFu;
+static const uint32_t clipOutcodeMask = 0x0000FF00u;
+
 // Just create a new camera on stack memory every time you need to render something
 class Camera {
 public: // Do not modify individual settings without assigning whole new cameras
 	bool perspective; // When off, widthSlope and heightSlope will be used as halfWidth and halfHeight.
 	Transform3D location; // Only translation and rotation allowed. Scaling and tilting will obviously not work for cameras.
 	float widthSlope, heightSlope, invWidthSlope, invHeightSlope, imageWidth, imageHeight, nearClip, farClip;
+	// The range of camera space depth stored in 16-bit depth buffers, from the highest value at depthRangeNear to zero at depthRangeFar.
+	//   Depth outside of the range is clamped to the closest end.
+	//   Defaults to the near and far clip planes for perspective cameras and to the range from zero to defaultFarClip for orthogonal cameras.
+	float depthRangeNear, depthRangeFar;
 	ViewFrustum cullFrustum, clipFrustum;
 	Camera() :
 	  perspective(true), location(Transform3D()), widthSlope(0.0f), heightSlope(0.0f),
 	  invWidthSlope(0.0f), invHeightSlope(0.0f), imageWidth(0), imageHeight(0),
-	  nearClip(0.0f), farClip(0.0f), cullFrustum(ViewFrustum()), clipFrustum(ViewFrustum()) {}
+	  nearClip(0.0f), farClip(0.0f), depthRangeNear(0.0f), depthRangeFar(0.0f), cullFrustum(ViewFrustum()), clipFrustum(ViewFrustum()) {}
 	Camera(bool perspective, const Transform3D &location, float imageWidth, float imageHeight, float widthSlope, float heightSlope, float nearClip, float farClip, const ViewFrustum &cullFrustum, const ViewFrustum &clipFrustum) :
 	  perspective(perspective), location(location), widthSlope(widthSlope), heightSlope(heightSlope),
 	  invWidthSlope(0.5f / widthSlope), invHeightSlope(0.5f / heightSlope), imageWidth(imageWidth), imageHeight(imageHeight),
-	  nearClip(nearClip), farClip(farClip), cullFrustum(cullFrustum), clipFrustum(clipFrustum) {}
+	  nearClip(nearClip), farClip(farClip), depthRangeNear(nearClip), depthRangeFar(farClip), cullFrustum(cullFrustum), clipFrustum(clipFrustum) {}
 public:
 	static Camera createPerspective(const Transform3D &location, float imageWidth, float imageHeight, float widthSlope = 1.0f, float nearClip = defaultNearClip, float farClip = defaultFarClip) {
 		float heightSlope = widthSlope * imageHeight / imageWidth;
 		return Camera(true, location, imageWidth, imageHeight, widthSlope, heightSlope, nearClip, farClip,
 		  ViewFrustum(nearClip, farClip, widthSlope * cullRatio, heightSlope * cullRatio),
-		  ViewFrustum(nearClip, farClip, widthSlope * clipRatio, heightSlope * clipRatio));
+		  ViewFrustum(nearClip, farClip, widthSlope * getClipRatio(imageWidth), heightSlope * getClipRatio(imageHeight)));
 	}
 	// Orthogonal cameras doesn't have any near or far clip planes
 	static Camera createOrthogonal(const Transform3D &location, float imageWidth, float imageHeight, float halfWidth) {
 		float halfHeight = halfWidth * imageHeight / imageWidth;
 		return Camera(false, location, imageWidth, imageHeight, halfWidth, halfHeight, -std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
 		  ViewFrustum(halfWidth * cullRatio, halfHeight * cullRatio),
-		  ViewFrustum(halfWidth * clipRatio, halfHeight * clipRatio));
+		  ViewFrustum(halfWidth * getClipRatio(imageWidth), halfHeight * getClipRatio(imageHeight))).getWithDepthRange(0.0f, defaultFarClip);
+	}
+	// Returns the same view projected to an image of another resolution, such as the samples of a multisampled target.
+	//   The guard band for clipping is recalculated for the new resolution.
+	Camera getResized(float newWidth, float newHeight) const {
+		ViewFrustum newClipFrustum = this->perspective
+		  ? ViewFrustum(this->nearClip, this->farClip, this->widthSlope * getClipRatio(newWidth), this->heightSlope * getClipRatio(newHeight))
+		  : ViewFrustum(this->widthSlope * getClipRatio(newWidth), this->heightSlope * getClipRatio(newHeight));
+		Camera result = Camera(this->perspective, this->location, newWidth, newHeight, this->widthSlope, this->heightSlope, this->nearClip, this->farClip, this->cullFrustum, newClipFrustum);
+		// Copied without validation, because the range was already checked when it was assigned
+		result.depthRangeNear = this->depthRangeNear;
+		result.depthRangeFar = this->depthRangeFar;
+		return result;
+	}
+	// Returns the same view with another range of depth for 16-bit depth buffers.
+	//   With perspective, the precision is spread evenly over the reciprocal depth, so a near depth far from the camera gives more precision in the distance.
+	//   farDepth may be infinite with perspective.
+	// Pre-condition: nearDepth < farDepth, and nearDepth > 0 for perspective cameras.
+	Camera getWithDepthRange(float nearDepth, float farDepth) const {
+		if (!(nearDepth < farDepth)) {
+			throwError("The near depth ", nearDepth, " given to Camera::getWithDepthRange is not less than the far depth ", farDepth, "!\n");
+		}
+		if (this->perspective && !(nearDepth > 0.0f)) {
+			throwError("The near depth ", nearDepth, " given to Camera::getWithDepthRange must be larger than zero for perspective cameras!\n");
+		}
+		Camera result = *this;
+		result.depthRangeNear = nearDepth;
+		result.depthRangeFar = farDepth;
+		return result;
 	}
 	FVector3D worldToCamera(const FVector3D &worldSpace) const {
 		return this->location.transformPointTransposedInverse(worldSpace);
@@ -155,6 +203,24 @@ public:
 	FPlane3D getFrustumPlane(int sideIndex, bool clipping) const {
 		return clipping ? this->clipFrustum.getPlane(sideIndex) : this->cullFrustum.getPlane(sideIndex);
 	}
+	// Returns a bit mask with one bit for each frustum plane that the camera space point is outside of.
+	//   Planes of the cull frustum are in the lower bits given by cullOutcodeMask.
+	//   Planes of the clip frustum are in the higher bits given by clipOutcodeMask.
+	//   Computed once per vertex, so that triangles sharing the vertex can test visibility by combining the masks of their corners.
+	uint32_t getOutcode(const FVector3D &cameraSpace) const {
+		uint32_t result = 0u;
+		for (int s = 0; s < this->cullFrustum.getPlaneCount(); s++) {
+			if (!(this->cullFrustum.getPlane(s).inside(cameraSpace))) {
+				result |= 1u << s;
+			}
+		}
+		for (int s = 0; s < this->clipFrustum.getPlaneCount(); s++) {
+			if (!(this->clipFrustum.getPlane(s).inside(cameraSpace))) {
+				result |= 1u << (s + clipOutcodeOffset);
+			}
+		}
+		return result;
+	}
 	// Returns false iff all 6 points from the box of minBound and maxBound multiplied by transform are outside of the same plane of cullFrustum
 	//   This is a quick indication to if something within that bound would be rendered
 	bool isBoxSeen(const FVector3D& minBound, const FVector3D& maxBound, const Transform3D &modelToWorld) const {
@@ -0,0 +1,171 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+#include "DepthHierarchy.h"
+#include "../image/internal/imageInternal.h"
+#include "../base/threading.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+using namespace dsr;
+
+template<typename DEPTH>
+static float getFarthestCloseness(const ImageImpl *image, int32_t left, int32_t top, int32_t right, int32_t bottom, float scale, float offset) {
+	int32_t stride = imageInternal::getStride(image);
+	float result = std::numeric_limits<float>::infinity();
+	const SafePointer<DEPTH> depthRow = imageInternal::getSafeData<DEPTH>(image, top);
+	for (int32_t y = top; y < bottom; y++) {
+		for (int32_t x = left; x < right; x++) {
+			float closeness = depthRow[x] * scale + offset;
+			if (closeness < result) { result = closeness; }
+		}
+		depthRow.increaseBytes(stride);
+	}
+	return result;
+}
+
+DepthHierarchy::DepthHierarchy(const DepthTarget &depthBuffer, bool perspective)
+: depthBuffer(depthBuffer), perspective(perspective),
+  blockCountX((imageInternal::getWidth(depthBuffer.image) + blockSize - 1) >> blockSizeLog2),
+  blockCountY((imageInternal::getHeight(depthBuffer.image) + blockSize - 1) >> blockSizeLog2),
+  farthest(blockCountX * blockCountY) {
+	int32_t width = imageInternal::getWidth(depthBuffer.image);
+	int32_t height = imageInternal::getHeight(depthBuffer.image);
+	if (depthBuffer.quantized) {
+		// Rounding to the closest integer may store a value half a step further away than the triangle,
+		//   and a triangle passes the depth test with a value rounded up to the stored value.
+		this->closenessScale = depthBuffer.scale;
+		this->closenessMargin = 1.5f;
+		this->closestCloseness = 65535.0f - depthBuffer.offset;
+	} else {
+		this->closenessScale = perspective ? 1.0f : -1.0f;
+		this->closenessMargin = 0.0f;
+		this->closestCloseness = std::numeric_limits<float>::infinity();
+	}
+	// Each job takes a row of blocks
+	threadedSplit(0, this->blockCountY, [this, width, height](int startBlockY, int stopBlockY) {
+		for (int32_t blockY = startBlockY; blockY < stopBlockY; blockY++) {
+			int32_t top = blockY << blockSizeLog2;
+			int32_t bottom = std::min(top + blockSize, height);
+			for (int32_t blockX = 0; blockX < this->blockCountX; blockX++) {
+				int32_t left = blockX << blockSizeLog2;
+				int32_t right = std::min(left + blockSize, width);
+				if (this->depthBuffer.quantized) {
+					this->getFarthest(blockX, blockY) = getFarthestCloseness<uint16_t>(this->depthBuffer.image, left, top, right, bottom, 1.0f, -this->depthBuffer.offset - this->closenessMargin);
+				} else {
+					this->getFarthest(blockX, blockY) = getFarthestCloseness<float>(this->depthBuffer.image, left, top, right, bottom, this->closenessScale, 0.0f);
+				}
+			}
+		}
+	}, 4);
+}
+
+// The range of closeness in a block from the triangle's depth plane, with some margin for rounding in the rasterizer
+static inline void getClosenessRange(const Projection &projection, float scale, int32_t blockX, int32_t blockY, float &minimum, float &maximum) {
+	// Pixel centers within the block are at most 3.5 pixels from its center, which is rounded up for safety
+	const float halfSize = DepthHierarchy::blockSize * 0.5f;
+	FVector2D center = FVector2D((blockX << DepthHierarchy::blockSizeLog2) + halfSize, (blockY << DepthHierarchy::blockSizeLog2) + halfSize);
+	float centerCloseness = (projection.pWeightStart.x + projection.pWeightDx.x * center.x + projection.pWeightDy.x * center.y) * scale;
+	float radius = (std::fabs(projection.pWeightDx.x) + std::fabs(projection.pWeightDy.x)) * std::fabs(scale) * halfSize + std::fabs(centerCloseness) * 0.0001f;
+	minimum = centerCloseness - radius;
+	maximum = centerCloseness + radius;
+}
+
+bool DepthHierarchy::cullRows(const Projection &projection, int startRow, int rowCount, RowInterval *rows) {
+	bool anyLeft = false;
+	int32_t firstBlockY = std::max(startRow >> blockSizeLog2, 0);
+	int32_t endBlockY = std::min(((startRow + rowCount - 1) >> blockSizeLog2) + 1, this->blockCountY);
+	for (int32_t blockY = firstBlockY; blockY < endBlockY; blockY++) {
+		int32_t firstRow = std::max(blockY << blockSizeLog2, startRow);
+		int32_t endRow = std::min((blockY + 1) << blockSizeLog2, startRow + rowCount);
+		// Get the horizontal range of blocks touched by the rows
+		int32_t left = std::numeric_limits<int32_t>::max();
+		int32_t right = std::numeric_limits<int32_t>::min();
+		for (int32_t y = firstRow; y < endRow; y++) {
+			const RowInterval &row = rows[y - startRow];
+			if (row.left < row.right) {
+				left = std::min(left, row.left);
+				right = std::max(right, row.right);
+			}
+		}
+		if (left >= right) {
+			continue;
+		}
+		int32_t firstBlockX = std::max(left >> blockSizeLog2, 0);
+		int32_t endBlockX = std::min(((right - 1) >> blockSizeLog2) + 1, this->blockCountX);
+		// Find the first and last blocks where the triangle might be visible
+		int32_t firstVisibleX = endBlockX;
+		int32_t lastVisibleX = firstBlockX - 1;
+		for (int32_t blockX = firstBlockX; blockX < endBlockX; blockX++) {
+			float minimum, maximum;
+			getClosenessRange(projection, this->closenessScale, blockX, blockY, minimum, maximum);
+			if (maximum > this->getFarthest(blockX, blockY)) {
+				if (firstVisibleX == endBlockX) { firstVisibleX = blockX; }
+				lastVisibleX = blockX;
+			}
+		}
+		// Cut away the occluded blocks from both sides of the rows
+		int32_t visibleLeft = firstVisibleX << blockSizeLog2;
+		int32_t visibleRight = (lastVisibleX + 1) << blockSizeLog2;
+		for (int32_t y = firstRow; y < endRow; y++) {
+			RowInterval &row = rows[y - startRow];
+			row.left = std::max(row.left, visibleLeft);
+			row.right = std::min(row.right, visibleRight);
+			if (row.left < row.right) {
+				anyLeft = true;
+			} else {
+				row.right = row.left;
+			}
+		}
+	}
+	return anyLeft;
+}
+
+void DepthHierarchy::update(const Projection &projection, int startRow, int rowCount, const RowInterval *rows) {
+	// Only blocks with all rows inside of the shape can be fully covered
+	int32_t firstBlockY = std::max((startRow + blockSize - 1) >> blockSizeLog2, 0);
+	int32_t endBlockY = std::min((startRow + rowCount) >> blockSizeLog2, this->blockCountY);
+	for (int32_t blockY = firstBlockY; blockY < endBlockY; blockY++) {
+		int32_t firstRow = blockY << blockSizeLog2;
+		// The horizontal range covered by all rows in the block
+		int32_t left = std::numeric_limits<int32_t>::min();
+		int32_t right = std::numeric_limits<int32_t>::max();
+		for (int32_t y = firstRow; y < firstRow + blockSize; y++) {
+			const RowInterval &row = rows[y - startRow];
+			left = std::max(left, row.left);
+			right = std::min(right, row.right);
+		}
+		int32_t firstBlockX = std::max((left + blockSize - 1) >> blockSizeLog2, 0);
+		int32_t endBlockX = std::min(right >> blockSizeLog2, this->blockCountX);
+		for (int32_t blockX = firstBlockX; blockX < endBlockX; blockX++) {
+			// Each pixel is now at least as close as the triangle, so the block can not be farther away than the triangle's farthest point
+			float minimum, maximum;
+			getClosenessRange(projection, this->closenessScale, blockX, blockY, minimum, maximum);
+			minimum = std::min(minimum, this->closestCloseness) - this->closenessMargin;
+			float &farthest = this->getFarthest(blockX, blockY);
+			if (minimum > farthest) {
+				farthest = minimum;
+			}
+		}
+	}
+}
@@ -0,0 +1,75 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+#ifndef DFPSR_RENDER_DEPTH_HIERARCHY
+#define DFPSR_RENDER_DEPTH_HIERARCHY
+
+#include <stdint.h>
+#include "ITriangle2D.h"
+#include "DepthTarget.h"
+#include "../base/Arena.h"
+
+namespace dsr {
+
+// A coarse copy of a depth buffer, storing the farthest depth of each 8x8 pixel block.
+//   Used to reject pixels of triangles that are fully behind everything already drawn in a block, before any shading is done.
+//   Depth is stored as closeness, which is 1 / depth for perspective and -depth for orthogonal projection,
+//   so that larger values are always closer to the camera.
+//   For quantized depth buffers, closeness is the quantized value before rounding and without the offset,
+//   with a margin for the rounding of stored values.
+//   Only valid while the depth buffer is modified by triangles passing through update, so it is created for each batch of triangles.
+//   Blocks start at multiples of 8 pixels, so that threads drawing separate tiles aligned to 8 pixels never share a block.
+class DepthHierarchy {
+public:
+	static const int blockSizeLog2 = 3;
+	static const int blockSize = 1 << blockSizeLog2;
+	const DepthTarget depthBuffer;
+	const bool perspective;
+	const int32_t blockCountX, blockCountY;
+private:
+	// Closeness is the interpolated depth multiplied by closenessScale
+	float closenessScale;
+	// Subtracted from the closeness of stored depth, so that rounding in quantized depth buffers cannot make visible pixels look occluded
+	float closenessMargin;
+	// The closest closeness that can be stored, which is limited by clamping in quantized depth buffers
+	float closestCloseness;
+	// The smallest closeness within each block, from the thread's arena
+	ArenaArray<float> farthest;
+	inline float &getFarthest(int32_t blockX, int32_t blockY) {
+		return this->farthest[blockX + blockY * this->blockCountX];
+	}
+public:
+	// Creates a hierarchy matching the current content of depthBuffer, using multiple threads.
+	DepthHierarchy(const DepthTarget &depthBuffer, bool perspective);
+	DepthHierarchy(const DepthHierarchy&) = delete;
+	DepthHierarchy& operator=(const DepthHierarchy&) = delete;
+	// Removes pixels in whole blocks from the start and end of each row, where the triangle cannot pass the depth test.
+	//   The projection must be made for the same depth buffer and perspective setting.
+	//   Returns false if no pixels remain.
+	bool cullRows(const Projection &projection, int startRow, int rowCount, RowInterval *rows);
+	// Update the blocks fully covered by the rows after drawing them with depth writing.
+	void update(const Projection &projection, int startRow, int rowCount, const RowInterval *rows);
+};
+
+}
+
+#endif
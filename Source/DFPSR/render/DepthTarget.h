@@ -0,0 +1,80 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+
+#ifndef DFPSR_RENDER_DEPTH_TARGET
+#define DFPSR_RENDER_DEPTH_TARGET
+
+#include <stdint.h>
+#include "../image/ImageF32.h"
+#include "../image/ImageU16.h"
+#include "Camera.h"
+
+namespace dsr {
+
+// The depth buffer that triangles are drawn to, which is either a 32-bit float image or a 16-bit quantized image.
+//   The interpolated depth is 1 / depth for perspective and linear depth for orthogonal cameras.
+//   Float depth buffers store the interpolated depth as it is.
+//   Quantized depth buffers store the interpolated depth multiplied by scale and added with offset, rounded to the closest integer.
+//     The camera's depth range is mapped to 65535 at the near end and zero at the far end,
+//     so that higher values are closer with any projection and clearing the image to zero is infinitely far away.
+struct DepthTarget {
+	ImageImpl *image;
+	bool quantized;
+	float scale, offset;
+	DepthTarget() : image(nullptr), quantized(false), scale(1.0f), offset(0.0f) {}
+	DepthTarget(ImageF32Impl *image) : image(image), quantized(false), scale(1.0f), offset(0.0f) {}
+	DepthTarget(ImageU16Impl *image, const Camera &camera) : image(image), quantized(true) {
+		float nearValue = camera.perspective ? 1.0f / camera.depthRangeNear : camera.depthRangeNear;
+		float farValue = camera.perspective ? 1.0f / camera.depthRangeFar : camera.depthRangeFar;
+		this->scale = 65535.0f / (nearValue - farValue);
+		this->offset = -farValue * this->scale;
+	}
+	bool exists() const {
+		return this->image != nullptr;
+	}
+	// Returns the value to store in a quantized depth buffer for the interpolated depth.
+	uint16_t quantize(float depth) const {
+		float value = depth * this->scale + this->offset + 0.5f;
+		if (value <= 0.0f) {
+			return 0;
+		} else if (value >= 65535.0f) {
+			return 65535;
+		} else {
+			return (uint16_t)value;
+		}
+	}
+	// Returns the interpolated depth from a value in a quantized depth buffer.
+	float dequantize(float value) const {
+		return (value - this->offset) / this->scale;
+	}
+};
+inline bool operator==(const DepthTarget &left, const DepthTarget &right) {
+	return left.image == right.image && left.quantized == right.quantized && left.scale == right.scale && left.offset == right.offset;
+}
+inline bool operator!=(const DepthTarget &left, const DepthTarget &right) {
+	return !(left == right);
+}
+
+}
+
+#endif
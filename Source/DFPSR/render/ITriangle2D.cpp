@@ -179,7 +179,7 @@ Projection ITriangle2D::getProjection(bool perspective) const {
 	return this->getProjection(FVector3D(0.0f, 1.0f, 0.0f), FVector3D(0.0f, 0.0f, 1.0f), perspective);
 }
 
-Projection ITriangle2D::getProjection(const FVector3D& subB, const FVector3D& subC, bool perspective) const {
+void ITriangle2D::getAffineWeights(FVector3D& targetWeight, FVector3D& affineWeightDx, FVector3D& affineWeightDy) const {
 /*
 	TODO: Find out why this implementation gives crap precision
 	FVector2D pointA = FVector2D(this->position[0].is.x, this->position[0].is.y);
@@ -219,7 +219,6 @@ Projection ITriangle2D::getProjection(const FVector3D& subB, const FVector3D& su
 		normalY[i] = offsetY[i] * weightMultiplier[i];
 	}
 	// Sample the weight of each corner at the upper left corner of the target image
-	FVector3D targetWeight;
 	for (int32_t i = 0; i < 3; i++) {
 		int o = (i + 2) % 3;
 		// Take the dot product to get a normalized weight
@@ -227,14 +226,17 @@ Projection ITriangle2D::getProjection(const FVector3D& subB, const FVector3D& su
 	}
 	// In order to calculate the perspective corrected vertex weights, we must first linearly iterate over the affine weights.
 	// Calculate affine weight derivatives for vertex indices from edge indices.
-	FVector3D affineWeightDx, affineWeightDy;
 	affineWeightDx.x = normalX.y;
 	affineWeightDx.y = normalX.z;
 	affineWeightDx.z = normalX.x;
 	affineWeightDy.x = normalY.y;
 	affineWeightDy.y = normalY.z;
 	affineWeightDy.z = normalY.x;
+}
 
+Projection ITriangle2D::getProjection(const FVector3D& subB, const FVector3D& subC, bool perspective) const {
+	FVector3D targetWeight, affineWeightDx, affineWeightDy;
+	this->getAffineWeights(targetWeight, affineWeightDx, affineWeightDy);
 	if (!perspective) {
 		// Get the linear depth
 		FVector3D W(this->position[0].cs.z, this->position[1].cs.z, this->position[2].cs.z);
@@ -299,3 +301,21 @@ Projection ITriangle2D::getProjection(const FVector3D& subB, const FVector3D& su
 	}
 }
 
+DepthPlane ITriangle2D::getDepthPlane(bool perspective) const {
+	FVector3D targetWeight, affineWeightDx, affineWeightDy;
+	this->getAffineWeights(targetWeight, affineWeightDx, affineWeightDy);
+	// Linear depth W for orthogonal cameras and 1 / W for perspective cameras can both be interpolated linearly in screen space
+	FVector3D cornerDepth;
+	if (perspective) {
+		cornerDepth = FVector3D(1.0f / this->position[0].cs.z, 1.0f / this->position[1].cs.z, 1.0f / this->position[2].cs.z);
+	} else {
+		cornerDepth = FVector3D(this->position[0].cs.z, this->position[1].cs.z, this->position[2].cs.z);
+	}
+	// Same calculations as for the first weight in getProjection, so that the depth is the same as when drawing with vertex weights
+	return DepthPlane(
+	  cornerDepth.x * targetWeight.x + cornerDepth.y * targetWeight.y + cornerDepth.z * targetWeight.z,
+	  cornerDepth.x * affineWeightDx.x + cornerDepth.y * affineWeightDx.y + cornerDepth.z * affineWeightDx.z,
+	  cornerDepth.x * affineWeightDy.x + cornerDepth.y * affineWeightDy.y + cornerDepth.z * affineWeightDy.z
+	);
+}
+
@@ -132,15 +132,32 @@ public:
 		}
 };
 
+// The depth part of a Projection, for drawing depth without any vertex weights
+//   Depth is linear depth W for orthogonal cameras and 1/W for perspective cameras, just like the first element of Projection's weights.
+class DepthPlane {
+public:
+	float depthStart; // Depth at the upper left corner of the target image
+	float depthDx; // The difference when X increases by 1
+	float depthDy; // The difference when Y increases by 1
+	DepthPlane() : depthStart(0.0f), depthDx(0.0f), depthDy(0.0f) {}
+	DepthPlane(float depthStart, float depthDx, float depthDy) : depthStart(depthStart), depthDx(depthDx), depthDy(depthDy) {}
+	// Returns the depth from the center of the pixel at screenPixel
+	float getDepth(const IVector2D& screenPixel) const {
+		return this->depthStart + (this->depthDx * (screenPixel.x + 0.5f)) + (this->depthDy * (screenPixel.y + 0.5f));
+	}
+};
+
 class RowShape {
 public:
 	// A collection of row intervals telling where pixels should be drawn
 	const int startRow;
 	const int rowCount;
 	const RowInterval *rows;
+	// When true, rows and columns are samples in a multisampled target with 2x2 samples for each pixel
+	const bool multisampled;
 	// Constructors
-	RowShape() : startRow(0), rowCount(0), rows(nullptr) {}
-	RowShape(int startRow, int rowCount, RowInterval* rows) : startRow(startRow), rowCount(rowCount), rows(rows) {}
+	RowShape() : startRow(0), rowCount(0), rows(nullptr), multisampled(false) {}
+	RowShape(int startRow, int rowCount, RowInterval* rows, bool multisampled = false) : startRow(startRow), rowCount(rowCount), rows(rows), multisampled(multisampled) {}
 };
 
 // Any extra information will be given to the filling method as this only gives the shape and vertex interpolation data
@@ -169,6 +186,11 @@ public:
 	Projection getProjection(const FVector3D& subB, const FVector3D& subC, bool perspective) const;
 	// Returns the vertex weight projection for default sub-vertex weights
 	Projection getProjection(bool perspective) const;
+	// Returns only the depth of the projection, for drawing depth without vertex weights
+	DepthPlane getDepthPlane(bool perspective) const;
+private:
+	// Get the affine weight of each corner at the upper left corner of the target image and how they change per pixel
+	void getAffineWeights(FVector3D& targetWeight, FVector3D& affineWeightDx, FVector3D& affineWeightDy) const;
 };
 
 }
@@ -0,0 +1,64 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+
+#ifndef DFPSR_RENDER_STATISTICS
+#define DFPSR_RENDER_STATISTICS
+
+#include <stdint.h>
+
+namespace dsr {
+
+// Counts and timings from drawing triangles through a command queue.
+//   Only collected when a command queue is given a pointer to write them to, so that nothing is counted when disabled.
+struct RenderStatistics {
+	// Triangles given to the command queue, before any culling
+	int64_t trianglesSubmitted = 0;
+	// Triangles skipped for being fully outside of the view frustum
+	int64_t trianglesCulledByFrustum = 0;
+	// Triangles skipped for facing away from the camera
+	int64_t trianglesCulledByFacing = 0;
+	// Triangles crossing the clip frustum, which were clipped into smaller triangles
+	int64_t trianglesClipped = 0;
+	// Draw commands removed by the renderer's occlusion grid
+	int64_t trianglesCulledByOcclusion = 0;
+	// Draw commands drawn when executing the command queue
+	int64_t trianglesDrawn = 0;
+	// Pixels given to pixel shaders, after clipping and skipping pixels hidden in the depth hierarchy
+	//   Includes pixels failing the depth test in the shader's raster loop.
+	//   Counts samples instead of pixels when multisampling.
+	int64_t pixelsShaded = 0;
+	// The number of jobs in CommandQueue::execute, which is the number of tiles when multi-threaded
+	int64_t jobCount = 0;
+	// The total time of all jobs in CommandQueue::execute, summed over threads
+	double jobSeconds = 0.0;
+	// The time of the slowest job in CommandQueue::execute
+	double slowestJobSeconds = 0.0;
+	// The time from start to end of CommandQueue::execute
+	double executeSeconds = 0.0;
+	// The time spent on removing occluded draw commands before execution
+	double occlusionSeconds = 0.0;
+};
+
+}
+
+#endif
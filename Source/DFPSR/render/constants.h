@@ -33,6 +33,11 @@ enum class Interpolation { NN, BL };
 
 enum class Filter { Solid, Alpha };
 
+// The order in which a command queue draws its triangles
+//   Submitted draws the triangles in the order that they were given.
+//   Depth draws solid triangles from front to back before drawing the other filters from back to front.
+enum class DrawOrder { Submitted, Depth };
+
 // A set of global constants that should be easy to access without getting cyclic dependencies
 namespace constants {
 
@@ -28,6 +28,8 @@
 #include "../../api/imageAPI.h"
 #include "../../image/ImageRgbaU8.h"
 #include "../../image/ImageF32.h"
+#include "../../base/Arena.h"
+#include "../../base/simd.h"
 
 using namespace dsr;
 
@@ -131,84 +133,187 @@ int Part::getPolygonVertexCount(int polygonIndex) const {
 //   TODO: Make a "validated" flag to check reference integrity before drawing models
 //         Only decreasing the length of the point buffer, changing a position index or adding new polygons should set it to false
 //         Only running validation before rendering should set it from false to true
-//   point indices may not go outside of projected's array range
-static void renderTriangleFromPolygon(CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, ImageF32Impl *depthBuffer, const Camera &camera, const Polygon &polygon, int triangleIndex, const ProjectedPoint *projected, Filter filter, const ImageRgbaU8Impl *diffuse, const ImageRgbaU8Impl *light) {
+//   point indices may not go outside of projected's and outcodes' array range
+static void renderTriangleFromPolygon(CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, const DepthTarget &depthBuffer, const Camera &camera, const Polygon &polygon, int triangleIndex, const ProjectedPoint *projected, const uint32_t *outcodes, Filter filter, const ImageRgbaU8Impl *diffuse, const ImageRgbaU8Impl *light) {
 	// Triangle fan starting from the first vertex of the polygon
 	int indexA = 0;
 	int indexB = 1 + triangleIndex;
 	int indexC = 2 + triangleIndex;
-	ProjectedPoint posA = projected[polygon.pointIndices[indexA]];
-	ProjectedPoint posB = projected[polygon.pointIndices[indexB]];
-	ProjectedPoint posC = projected[polygon.pointIndices[indexC]];
+	int pointA = polygon.pointIndices[indexA];
+	int pointB = polygon.pointIndices[indexB];
+	int pointC = polygon.pointIndices[indexC];
+	uint32_t outcodeA = outcodes[pointA];
+	uint32_t outcodeB = outcodes[pointB];
+	uint32_t outcodeC = outcodes[pointC];
+	// Reject triangles outside of the view before reading any vertex data
+	if (getTriangleVisibility(outcodeA, outcodeB, outcodeC, false) == Visibility::Hidden) {
+		// Counted here, because renderTriangleFromData only counts the triangles given to it
+		if (commandQueue != nullptr && commandQueue->statistics != nullptr) {
+			commandQueue->statistics->trianglesSubmitted++;
+			commandQueue->statistics->trianglesCulledByFrustum++;
+		}
+		return;
+	}
+	const ProjectedPoint &posA = projected[pointA];
+	const ProjectedPoint &posB = projected[pointB];
+	const ProjectedPoint &posC = projected[pointC];
 	// Read texture coordinates and convert to planar format in the constructor
 	TriangleTexCoords texCoords(polygon.texCoords[indexA], polygon.texCoords[indexB], polygon.texCoords[indexC]);
 	// Read colors and convert to planar format in the constructor
 	TriangleColors colors(polygon.colors[indexA], polygon.colors[indexB], polygon.colors[indexC]);
-	renderTriangleFromData(commandQueue, targetImage, depthBuffer, camera, posA, posB, posC, filter, diffuse, light, texCoords, colors);
+	renderTriangleFromData(commandQueue, targetImage, depthBuffer, camera, posA, posB, posC, outcodeA, outcodeB, outcodeC, filter, diffuse, light, texCoords, colors);
 }
 
-void Part::render(CommandQueue *commandQueue, ImageRgbaU8& targetImage, ImageF32& depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera, Filter filter, const ProjectedPoint* projected) const {
+void Part::render(CommandQueue *commandQueue, ImageRgbaU8& targetImage, const DepthTarget &depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera, Filter filter, const ProjectedPoint* projected, const uint32_t* outcodes) const {
 	// Get textures
 	const ImageRgbaU8Impl *diffuse = this->diffuseMap.get();
 	const ImageRgbaU8Impl *light = this->lightMap.get();
 	for (int p = 0; p < this->polygonBuffer.length(); p++) {
-		Polygon polygon = this->polygonBuffer[p];
+		const Polygon &polygon = this->polygonBuffer[p];
 		if (polygon.pointIndices[3] == -1) {
 			// Render triangle
-			renderTriangleFromPolygon(commandQueue, targetImage.get(), depthBuffer.get(), camera, polygon, 0, projected, filter, diffuse, light);
+			renderTriangleFromPolygon(commandQueue, targetImage.get(), depthBuffer, camera, polygon, 0, projected, outcodes, filter, diffuse, light);
 		} else {
 			// Render quad
-			renderTriangleFromPolygon(commandQueue, targetImage.get(), depthBuffer.get(), camera, polygon, 0, projected, filter, diffuse, light);
-			renderTriangleFromPolygon(commandQueue, targetImage.get(), depthBuffer.get(), camera, polygon, 1, projected, filter, diffuse, light);
+			renderTriangleFromPolygon(commandQueue, targetImage.get(), depthBuffer, camera, polygon, 0, projected, outcodes, filter, diffuse, light);
+			renderTriangleFromPolygon(commandQueue, targetImage.get(), depthBuffer, camera, polygon, 1, projected, outcodes, filter, diffuse, light);
 		}
 	}
 }
 
-void Part::renderDepth(ImageF32& depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera, const ProjectedPoint* projected) const {
+void Part::renderDepth(const DepthTarget &depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera, const ProjectedPoint* projected, const uint32_t* outcodes) const {
 	for (int p = 0; p < this->polygonBuffer.length(); p++) {
-		Polygon polygon = this->polygonBuffer[p];
+		const Polygon &polygon = this->polygonBuffer[p];
+		int pointA = polygon.pointIndices[0];
+		int pointB = polygon.pointIndices[1];
+		int pointC = polygon.pointIndices[2];
 		if (polygon.pointIndices[3] == -1) {
 			// Render triangle
-			ProjectedPoint posA = projected[polygon.pointIndices[0]];
-			ProjectedPoint posB = projected[polygon.pointIndices[1]];
-			ProjectedPoint posC = projected[polygon.pointIndices[2]];
-			renderTriangleFromDataDepth(depthBuffer.get(), camera, posA, posB, posC);
+			renderTriangleFromDataDepth(depthBuffer, camera, projected[pointA], projected[pointB], projected[pointC], outcodes[pointA], outcodes[pointB], outcodes[pointC]);
 		} else {
 			// Render quad
-			ProjectedPoint posA = projected[polygon.pointIndices[0]];
-			ProjectedPoint posB = projected[polygon.pointIndices[1]];
-			ProjectedPoint posC = projected[polygon.pointIndices[2]];
-			ProjectedPoint posD = projected[polygon.pointIndices[3]];
-			renderTriangleFromDataDepth(depthBuffer.get(), camera, posA, posB, posC);
-			renderTriangleFromDataDepth(depthBuffer.get(), camera, posA, posC, posD);
+			int pointD = polygon.pointIndices[3];
+			renderTriangleFromDataDepth(depthBuffer, camera, projected[pointA], projected[pointB], projected[pointC], outcodes[pointA], outcodes[pointB], outcodes[pointC]);
+			renderTriangleFromDataDepth(depthBuffer, camera, projected[pointA], projected[pointC], projected[pointD], outcodes[pointA], outcodes[pointC], outcodes[pointD]);
 		}
 	}
 }
 
-void ModelImpl::render(CommandQueue *commandQueue, ImageRgbaU8& targetImage, ImageF32& depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera) const {
+// Transforms positions from model space to camera space and projects them to the target image.
+//   Gives the same result as camera.worldToScreen(modelToWorldTransform.transformPoint(position)) for each position,
+//   but transforms four positions at a time in structure of arrays form to let SIMD do most of the work.
+static void projectPositions(ProjectedPoint *projected, uint32_t *outcodes, const List<FVector3D> &positions, const Transform3D &modelToWorldTransform, const Camera &camera) {
+	int positionCount = positions.length();
+	const FMatrix3x3 &modelAxes = modelToWorldTransform.transform;
+	const FVector3D &modelPosition = modelToWorldTransform.position;
+	const FMatrix3x3 &cameraAxes = camera.location.transform;
+	const FVector3D &cameraPosition = camera.location.position;
+	// Gather the planes of both frustums together with the outcode bit that each plane sets
+	FPlane3D planes[12];
+	uint32_t planeBits[12];
+	uint32_t allPlaneBits = 0u;
+	int planeCount = 0;
+	for (int frustum = 0; frustum < 2; frustum++) {
+		bool clipping = frustum == 1;
+		for (int s = 0; s < camera.getFrustumPlaneCount(clipping); s++) {
+			planes[planeCount] = camera.getFrustumPlane(s, clipping);
+			planeBits[planeCount] = 1u << (clipping ? s + clipOutcodeOffset : s);
+			allPlaneBits |= planeBits[planeCount];
+			planeCount++;
+		}
+	}
+	int vert = 0;
+	for (; vert + 3 < positionCount; vert += 4) {
+		const FVector3D &a = positions[vert];
+		const FVector3D &b = positions[vert + 1];
+		const FVector3D &c = positions[vert + 2];
+		const FVector3D &d = positions[vert + 3];
+		F32x4 modelX(a.x, b.x, c.x, d.x);
+		F32x4 modelY(a.y, b.y, c.y, d.y);
+		F32x4 modelZ(a.z, b.z, c.z, d.z);
+		// Model space to world space
+		F32x4 worldX = modelX * modelAxes.xAxis.x + modelY * modelAxes.yAxis.x + modelZ * modelAxes.zAxis.x + modelPosition.x;
+		F32x4 worldY = modelX * modelAxes.xAxis.y + modelY * modelAxes.yAxis.y + modelZ * modelAxes.zAxis.y + modelPosition.y;
+		F32x4 worldZ = modelX * modelAxes.xAxis.z + modelY * modelAxes.yAxis.z + modelZ * modelAxes.zAxis.z + modelPosition.z;
+		// World space to camera space
+		F32x4 relativeX = worldX - cameraPosition.x;
+		F32x4 relativeY = worldY - cameraPosition.y;
+		F32x4 relativeZ = worldZ - cameraPosition.z;
+		F32x4 cameraX = relativeX * cameraAxes.xAxis.x + relativeY * cameraAxes.xAxis.y + relativeZ * cameraAxes.xAxis.z;
+		F32x4 cameraY = relativeX * cameraAxes.yAxis.x + relativeY * cameraAxes.yAxis.y + relativeZ * cameraAxes.yAxis.z;
+		F32x4 cameraZ = relativeX * cameraAxes.zAxis.x + relativeY * cameraAxes.zAxis.y + relativeZ * cameraAxes.zAxis.z;
+		// Test against the view frustums in the same way as camera.getOutcode, by collecting the planes that each point is inside of
+		U32x4 insideBits = U32x4(0u);
+		for (int p = 0; p < planeCount; p++) {
+			const FPlane3D &plane = planes[p];
+			F32x4 distance = cameraX * plane.normal.x + cameraY * plane.normal.y + cameraZ * plane.normal.z - plane.offset;
+			insideBits = insideBits | (lessOrEqualMask(distance, F32x4(0.0f)) & planeBits[p]);
+		}
+		uint32_t codes[4] ALIGN16;
+		(insideBits ^ allPlaneBits).writeAlignedUnsafe(codes);
+		// Camera space to image space
+		float depth[4] ALIGN16;
+		cameraZ.writeAlignedUnsafe(depth);
+		F32x4 centerShear = F32x4(0.5f);
+		F32x4 invDepth = F32x4(1.0f); // Multiplying by one is exact, so orthogonal cameras can use the same expression
+		if (camera.perspective) {
+			centerShear = cameraZ * 0.5f;
+			// Divide in scalar form to get the same precision as camera.cameraToScreen
+			invDepth = F32x4(
+			  depth[0] > 0.0f ? 1.0f / depth[0] : 0.0f,
+			  depth[1] > 0.0f ? 1.0f / depth[1] : 0.0f,
+			  depth[2] > 0.0f ? 1.0f / depth[2] : 0.0f,
+			  depth[3] > 0.0f ? 1.0f / depth[3] : 0.0f
+			);
+		}
+		F32x4 imageX = (cameraX * camera.invWidthSlope + centerShear) * camera.imageWidth * invDepth;
+		F32x4 imageY = (cameraY * -camera.invHeightSlope + centerShear) * camera.imageHeight * invDepth;
+		F32x4 subPixelX = imageX * (float)constants::unitsPerPixel;
+		F32x4 subPixelY = imageY * (float)constants::unitsPerPixel;
+		// Write the results in array of structures form
+		float csX[4] ALIGN16, csY[4] ALIGN16, isX[4] ALIGN16, isY[4] ALIGN16, flatX[4] ALIGN16, flatY[4] ALIGN16;
+		cameraX.writeAlignedUnsafe(csX);
+		cameraY.writeAlignedUnsafe(csY);
+		imageX.writeAlignedUnsafe(isX);
+		imageY.writeAlignedUnsafe(isY);
+		subPixelX.writeAlignedUnsafe(flatX);
+		subPixelY.writeAlignedUnsafe(flatY);
+		for (int i = 0; i < 4; i++) {
+			projected[vert + i] = ProjectedPoint(FVector3D(csX[i], csY[i], depth[i]), FVector2D(isX[i], isY[i]), LVector2D(safeRoundInt64(flatX[i]), safeRoundInt64(flatY[i])));
+			outcodes[vert + i] = codes[i];
+		}
+	}
+	// Project the remaining positions one at a time
+	for (; vert < positionCount; vert++) {
+		projected[vert] = camera.worldToScreen(modelToWorldTransform.transformPoint(positions[vert]));
+		outcodes[vert] = camera.getOutcode(projected[vert].cs);
+	}
+}
+
+void ModelImpl::render(CommandQueue *commandQueue, ImageRgbaU8& targetImage, const DepthTarget &depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera) const {
 	if (camera.isBoxSeen(this->minBound, this->maxBound, modelToWorldTransform)) {
 		// Transform and project all vertices
 		int positionCount = positionBuffer.length();
-		ProjectedPoint projected[positionCount]; // TODO: Only use stack memory with VLA when the number of points is resonable
-		for (int vert = 0; vert < positionCount; vert++) {
-			projected[vert] = camera.worldToScreen(modelToWorldTransform.transformPoint(positionBuffer[vert]));
-		}
+		ArenaArray<ProjectedPoint> projected(positionCount);
+		// Test each vertex against the view frustum once, so that triangles sharing the vertex can be accepted or rejected by combining outcodes
+		ArenaArray<uint32_t> outcodes(positionCount);
+		projectPositions(projected.getUnsafe(), outcodes.getUnsafe(), this->positionBuffer, modelToWorldTransform, camera);
 		for (int partIndex = 0; partIndex < this->partBuffer.length(); partIndex++) {
-			this->partBuffer[partIndex].render(commandQueue, targetImage, depthBuffer, modelToWorldTransform, camera, this->filter, projected);
+			this->partBuffer[partIndex].render(commandQueue, targetImage, depthBuffer, modelToWorldTransform, camera, this->filter, projected.getUnsafe(), outcodes.getUnsafe());
 		}
 	}
 }
 
-void ModelImpl::renderDepth(ImageF32& depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera) const {
+void ModelImpl::renderDepth(const DepthTarget &depthBuffer, const Transform3D &modelToWorldTransform, const Camera &camera) const {
 	if (camera.isBoxSeen(this->minBound, this->maxBound, modelToWorldTransform)) {
 		// Transform and project all vertices
 		int positionCount = positionBuffer.length();
-		ProjectedPoint projected[positionCount]; // TODO: Only use stack memory with VLA when the number of points is resonable
-		for (int vert = 0; vert < positionCount; vert++) {
-			projected[vert] = camera.worldToScreen(modelToWorldTransform.transformPoint(positionBuffer[vert]));
-		}
+		ArenaArray<ProjectedPoint> projected(positionCount);
+		// Test each vertex against the view frustum once, so that triangles sharing the vertex can be accepted or rejected by combining outcodes
+		ArenaArray<uint32_t> outcodes(positionCount);
+		projectPositions(projected.getUnsafe(), outcodes.getUnsafe(), this->positionBuffer, modelToWorldTransform, camera);
 		for (int partIndex = 0; partIndex < this->partBuffer.length(); partIndex++) {
-			this->partBuffer[partIndex].renderDepth(depthBuffer, modelToWorldTransform, camera, projected);
+			this->partBuffer[partIndex].renderDepth(depthBuffer, modelToWorldTransform, camera, projected.getUnsafe(), outcodes.getUnsafe());
 		}
 	}
 }
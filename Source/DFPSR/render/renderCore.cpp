@@ -22,11 +22,17 @@
 //    distribution.
 
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
 #include "renderCore.h"
 #include "../image/internal/imageInternal.h"
 #include "shader/Shader.h"
 #include "shader/RgbaMultiply.h"
 #include "constants.h"
+#include "../base/Arena.h"
+#include "DepthHierarchy.h"
+#include "../api/timeAPI.h"
 
 using namespace dsr;
 
@@ -38,8 +44,6 @@ class SubVertex {
 public:
 	FVector3D cs; // Camera space position based on the weights
 	float subB, subC; // Weights for second and third vertices in the parent triangle
-	int state = 0; // Used by algorithms
-	float value = 0.0f; // Used by algorithms
 	SubVertex() : cs(FVector3D()), subB(0.0f), subC(0.0f) {}
 	SubVertex(FVector3D cs, float subB, float subC) : cs(cs), subB(subB), subC(subC) {}
 	SubVertex(SubVertex vertexA, SubVertex vertexB, float ratio) {
@@ -77,97 +81,45 @@ public:
 		this->vertices[2] = SubVertex(triangle.position[2].cs, 0.0f, 1.0f);
 		this->vertexCount = 3;
 	}
-	void deleteVertex(int removeIndex) {
-		assert(removeIndex >= 0);
-		assert(removeIndex < this->vertexCount);
-		if (this->vertexCount > 0 && this->vertexCount <= maxPoints) {
-			for (int v = removeIndex; v < this->vertexCount - 1; v++) {
-				assert(v >= 0 && v + 1 < maxPoints);
-				this->vertices[v] = this->vertices[v + 1];
-			}
-			this->vertexCount--;
-		}
-	}
-	void insertVertex(int newIndex, const SubVertex &newVertex) {
-		// Check against buffer overflow in case of bugs from rounding errors
-		assert(newIndex >= 0);
-		assert(newIndex <= this->vertexCount);
-		if (this->vertexCount < maxPoints) {
-			for (int v = this->vertexCount - 1; v >= newIndex; v--) {
-				assert(v >= 0 && v + 1 < maxPoints);
-				this->vertices[v + 1] = this->vertices[v];
-			}
-			this->vertices[newIndex] = newVertex;
-			this->vertexCount++;
-		}
-	}
 	void deleteAll() {
 		this->vertexCount = 0;
 	}
 	// Cut away parts of the triangle that are on the positive side of the plane
 	void clip(const FPlane3D &plane) {
-		static const int state_use = 0;
-		static const int state_delete = 1;
-		static const int state_modified = 2;
 		if (this->vertexCount >= 3 && this->vertexCount < maxPoints) {
+			float distances[maxPoints];
 			int outsideCount = 0;
-			int lastOutside = 0;
 			for (int v = 0; v < this->vertexCount; v++) {
-				assert(v >= 0 && v < maxPoints);
-				float distance = plane.signedDistance(this->vertices[v].cs);
-				this->vertices[v].value = distance;
-				if (distance > 0.0f) {
+				distances[v] = plane.signedDistance(this->vertices[v].cs);
+				if (distances[v] > 0.0f) {
 					outsideCount++;
-					lastOutside = v;
-					this->vertices[v].state = state_delete;
-				} else {
-					this->vertices[v].state = state_use;
 				}
 			}
-			if (outsideCount > 0) {
-				if (outsideCount >= this->vertexCount) {
-					this->deleteAll();
-				} else if (outsideCount == 1) {
-					// Split a single vertex into two corners by interpolating with the previous and next corners						
-					int currentVertex = lastOutside;
-					int previousVertex = (lastOutside - 1 + this->vertexCount) % this->vertexCount;
-					int nextVertex = (lastOutside + 1) % this->vertexCount;
-					float previousToCurrentRatio = inverseLerp(this->vertices[previousVertex].value, this->vertices[currentVertex].value, 0.0f);
-					float currentToNextRatio = inverseLerp(this->vertices[currentVertex].value, this->vertices[nextVertex].value, 0.0f);
-					SubVertex cutStart(this->vertices[previousVertex], this->vertices[currentVertex], previousToCurrentRatio);
-					SubVertex cutEnd(this->vertices[currentVertex], this->vertices[nextVertex], currentToNextRatio);
-					this->vertices[lastOutside] = cutStart;
-					insertVertex(nextVertex, cutEnd);
-				} else {
-					// Start and end of the cut
-					for (int currentVertex = 0; currentVertex < this->vertexCount; currentVertex++) {
-						int previousVertex = (currentVertex - 1 + this->vertexCount) % this->vertexCount;
-						int nextVertex = (currentVertex + 1) % this->vertexCount;
-						if (this->vertices[currentVertex].state == state_delete) {
-							if (this->vertices[previousVertex].state == state_use) {
-								// Begin the cut
-								float previousToCurrentRatio = inverseLerp(this->vertices[previousVertex].value, this->vertices[currentVertex].value, 0.0f);
-								this->vertices[currentVertex] = SubVertex(this->vertices[previousVertex], this->vertices[currentVertex], previousToCurrentRatio);
-								this->vertices[currentVertex].state = state_modified;
-							} else if (this->vertices[nextVertex].state == state_use) {
-								// End the cut
-								float currentToNextRatio = inverseLerp(this->vertices[currentVertex].value, this->vertices[nextVertex].value, 0.0f);
-								this->vertices[currentVertex] = SubVertex(this->vertices[currentVertex], this->vertices[nextVertex], currentToNextRatio);
-								this->vertices[currentVertex].state = state_modified;
-							}
-						}
+			if (outsideCount >= this->vertexCount) {
+				this->deleteAll();
+			} else if (outsideCount > 0) {
+				// Keep the corners inside and add a new corner where an edge crosses the plane, in a single pass over the edges
+				//   A convex polygon crosses the plane twice, so the polygon can grow by at most one corner
+				SubVertex result[maxPoints];
+				int resultCount = 0;
+				for (int currentVertex = 0; currentVertex < this->vertexCount; currentVertex++) {
+					int nextVertex = (currentVertex + 1) % this->vertexCount;
+					bool currentInside = distances[currentVertex] <= 0.0f;
+					bool nextInside = distances[nextVertex] <= 0.0f;
+					if (currentInside) {
+						result[resultCount] = this->vertices[currentVertex];
+						resultCount++;
 					}
-					// Delete every vertex that is marked for removal
-					// Looping backwards will avoid using altered indices while deleting
-					if (outsideCount > 2) {
-						for (int v = this->vertexCount - 1; v >= 0; v--) {
-							assert(v >= 0 && v < maxPoints);
-							if (this->vertices[v].state == state_delete) {
-								this->deleteVertex(v);
-							}
-						}
+					if (currentInside != nextInside && resultCount < maxPoints) {
+						float currentToNextRatio = inverseLerp(distances[currentVertex], distances[nextVertex], 0.0f);
+						result[resultCount] = SubVertex(this->vertices[currentVertex], this->vertices[nextVertex], currentToNextRatio);
+						resultCount++;
 					}
 				}
+				for (int v = 0; v < resultCount; v++) {
+					this->vertices[v] = result[v];
+				}
+				this->vertexCount = resultCount;
 			}
 		}
 	}
@@ -224,17 +176,33 @@ static bool almostSame(const FVector3D &channel) {
 static const int alignX = 2;
 static const int alignY = 2;
 
-void dsr::executeTriangleDrawing(const TriangleDrawCommand &command, const IRect &clipBound) {
+void dsr::executeTriangleDrawing(const TriangleDrawState &state, const TriangleDrawCommand &command, const IRect &clipBound, DepthHierarchy *depthHierarchy, bool multisampled, RenderStatistics *statistics) {
 	IRect finalClipBound = IRect::cut(command.clipBound, clipBound);
 	int32_t rowCount = command.triangle.getBufferSize(finalClipBound, alignX, alignY);
 	if (rowCount > 0) {
 		int startRow;
-		RowInterval rows[rowCount];
-		command.triangle.getShape(startRow, rows, finalClipBound, alignX, alignY);
-		Projection projection = command.triangle.getProjection(command.subB, command.subC, command.perspective);
-		command.processTriangle(command.triangleInput, command.targetImage, command.depthBuffer, command.triangle, projection, RowShape(startRow, rowCount, rows), command.filter);
+		ArenaArray<RowInterval> rows(rowCount);
+		command.triangle.getShape(startRow, rows.getUnsafe(), finalClipBound, alignX, alignY);
+		Projection projection = command.triangle.getProjection(command.subB, command.subC, state.perspective);
+		bool useHierarchy = depthHierarchy != nullptr && state.depthBuffer == depthHierarchy->depthBuffer && state.perspective == depthHierarchy->perspective;
+		if (useHierarchy && !depthHierarchy->cullRows(projection, startRow, rowCount, rows.getUnsafe())) {
+			// Fully hidden behind what is already drawn
+			return;
+		}
+		if (statistics != nullptr) {
+			for (int32_t r = 0; r < rowCount; r++) {
+				if (rows[r].right > rows[r].left) {
+					statistics->pixelsShaded += rows[r].right - rows[r].left;
+				}
+			}
+		}
+		state.processTriangle(command.triangleInput, state.targetImage, state.depthBuffer, command.triangle, projection, RowShape(startRow, rowCount, rows.getUnsafe(), multisampled), state.filter);
+		// Only solid triangles write to the depth buffer
+		if (useHierarchy && state.filter == Filter::Solid) {
+			depthHierarchy->update(projection, startRow, rowCount, rows.getUnsafe());
+		}
 		#ifdef SHOW_POST_CLIPPING_WIREFRAME
-			drawWireframe(command.targetImage, command.triangle);
+			drawWireframe(state.targetImage, command.triangle);
 		#endif
 	}
 }
@@ -254,9 +222,9 @@ static void drawSubTriangle(CommandQueue *commandQueue, const TriangleDrawData &
 	if (triangle.isFrontfacing()) {
 		TriangleDrawCommand command(triangleDrawData, triangle, subB, subC, clipBound);
 		if (commandQueue) {
-			commandQueue->add(command);
+			commandQueue->add(triangleDrawData, command);
 		} else {
-			executeTriangleDrawing(command, clipBound);
+			executeTriangleDrawing(TriangleDrawState(triangleDrawData), command, clipBound);
 		}
 		
 	}
@@ -281,10 +249,9 @@ static void drawClippedTriangle(CommandQueue *commandQueue, const TriangleDrawDa
 }
 
 // Clipping is applied automatically if needed
-void dsr::renderTriangleWithShader(CommandQueue *commandQueue, const TriangleDrawData &triangleDrawData, const Camera &camera, const ITriangle2D &triangle, const IRect &clipBound) {
-	// Allow small triangles to be a bit outside of the view frustum without being clipped by increasing the width and height slopes in a second test
-	// This reduces redundant clipping to improve both speed and quality
-	Visibility paddedVisibility = getTriangleVisibility(triangle, camera, true);
+//   paddedVisibility is the triangle's visibility in the clip frustum.
+static void impl_renderTriangleWithShader(CommandQueue *commandQueue, const TriangleDrawData &triangleDrawData, const Camera &camera, const ITriangle2D &triangle, const IRect &clipBound, Visibility paddedVisibility) {
+	RenderStatistics *statistics = commandQueue ? commandQueue->statistics : nullptr;
 	// Draw the triangle
 	if (paddedVisibility == Visibility::Full) {
 		// Only check if the triangle is front facing once we know that the projection is in positive depth
@@ -292,39 +259,75 @@ void dsr::renderTriangleWithShader(CommandQueue *commandQueue, const TriangleDra
 			// Draw the full triangle
 			TriangleDrawCommand command(triangleDrawData, triangle, FVector3D(0.0f, 1.0f, 0.0f), FVector3D(0.0f, 0.0f, 1.0f), clipBound);
 			if (commandQueue) {
-				commandQueue->add(command);
+				commandQueue->add(triangleDrawData, command);
 			} else {
-				executeTriangleDrawing(command, clipBound);
+				executeTriangleDrawing(TriangleDrawState(triangleDrawData), command, clipBound);
 			}
+		} else if (statistics != nullptr) {
+			statistics->trianglesCulledByFacing++;
 		}
 	} else {
+		if (statistics != nullptr) {
+			statistics->trianglesClipped++;
+		}
 		// Draw a clipped triangle
 		drawClippedTriangle(commandQueue, triangleDrawData, camera, triangle, clipBound);
 	}
 }
 
+void dsr::renderTriangleWithShader(CommandQueue *commandQueue, const TriangleDrawData &triangleDrawData, const Camera &camera, const ITriangle2D &triangle, const IRect &clipBound) {
+	if (commandQueue != nullptr && commandQueue->statistics != nullptr) {
+		commandQueue->statistics->trianglesSubmitted++;
+	}
+	// Allow small triangles to be a bit outside of the view frustum without being clipped by increasing the width and height slopes in a second test
+	// This reduces redundant clipping to improve both speed and quality
+	impl_renderTriangleWithShader(commandQueue, triangleDrawData, camera, triangle, clipBound, getTriangleVisibility(triangle, camera, true));
+}
+
 // TODO: Move shader selection to Shader_RgbaMultiply and let models default to its shader factory function pointer as shader selection
 void dsr::renderTriangleFromData(
-  CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, ImageF32Impl *depthBuffer,
+  CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, const DepthTarget &depthBuffer,
+  const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC,
+  Filter filter, const ImageRgbaU8Impl *diffuse, const ImageRgbaU8Impl *light,
+  TriangleTexCoords texCoords, TriangleColors colors) {
+	renderTriangleFromData(commandQueue, targetImage, depthBuffer, camera, posA, posB, posC,
+	  camera.getOutcode(posA.cs), camera.getOutcode(posB.cs), camera.getOutcode(posC.cs),
+	  filter, diffuse, light, texCoords, colors);
+}
+
+void dsr::renderTriangleFromData(
+  CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, const DepthTarget &depthBuffer,
   const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC,
+  uint32_t outcodeA, uint32_t outcodeB, uint32_t outcodeC,
   Filter filter, const ImageRgbaU8Impl *diffuse, const ImageRgbaU8Impl *light,
   TriangleTexCoords texCoords, TriangleColors colors) {
+	RenderStatistics *statistics = commandQueue ? commandQueue->statistics : nullptr;
+	if (statistics != nullptr) {
+		statistics->trianglesSubmitted++;
+	}
+	// Only draw visible triangles
+	if (getTriangleVisibility(outcodeA, outcodeB, outcodeC, false) == Visibility::Hidden) {
+		if (statistics != nullptr) {
+			statistics->trianglesCulledByFrustum++;
+		}
+		return;
+	}
 	// Get dimensions from both buffers
 	int colorWidth = imageInternal::getWidth(targetImage);
 	int colorHeight = imageInternal::getHeight(targetImage);
-	int depthWidth = imageInternal::getWidth(depthBuffer);
-	int depthHeight = imageInternal::getHeight(depthBuffer);
+	int depthWidth = imageInternal::getWidth(depthBuffer.image);
+	int depthHeight = imageInternal::getHeight(depthBuffer.image);
 	// Combine dimensions
 	int targetWidth, targetHeight;
 	if (targetImage != nullptr) {
 		targetWidth = colorWidth;
 		targetHeight = colorHeight;
-		if (depthBuffer != nullptr) {
+		if (depthBuffer.exists()) {
 			assert(targetWidth == depthWidth);
 			assert(targetHeight == depthHeight);
 		}
 	} else {
-		if (depthBuffer != nullptr) {
+		if (depthBuffer.exists()) {
 			targetWidth = depthWidth;
 			targetHeight = depthHeight;
 		} else {
@@ -335,135 +338,179 @@ void dsr::renderTriangleFromData(
 	IRect clipBound = IRect::FromSize(targetWidth, targetHeight);
 	// Create a triangle
 	ITriangle2D triangle(posA, posB, posC);
-	// Only draw visible triangles
-	Visibility visibility = getTriangleVisibility(triangle, camera, false);
-	if (visibility != Visibility::Hidden) {
-		// Disable features when debugging
-		#ifdef DISABLE_VERTEX_COLOR
-			colors = TriangleColors(1.0f);
-		#endif
-		#ifdef DISABLE_DIFFUSE_MAP
-			diffuse = nullptr;
-		#endif
-		#ifdef DISABLE_LIGHT_MAP
-			light = nullptr;
-		#endif
-		// Select an instance of the default shader
-		if (!(filter == Filter::Alpha && almostZero(colors.alpha))) {
-			bool hasVertexFade = !(almostSame(colors.red) && almostSame(colors.green) && almostSame(colors.blue) && almostSame(colors.alpha));
-			bool colorless = almostOne(colors.red) && almostOne(colors.green) && almostOne(colors.blue) && almostOne(colors.alpha);
-			// Get the function pointer to the correct shader
-			DRAW_CALLBACK_TYPE drawTask = &drawCallbackTemplate;
-			if (diffuse) {
-				bool hasDiffusePyramid = diffuse->texture.hasMipBuffer();
-				if (light) {
-					if (hasVertexFade) { // DiffuseLightVertex
+	// Disable features when debugging
+	#ifdef DISABLE_VERTEX_COLOR
+		colors = TriangleColors(1.0f);
+	#endif
+	#ifdef DISABLE_DIFFUSE_MAP
+		diffuse = nullptr;
+	#endif
+	#ifdef DISABLE_LIGHT_MAP
+		light = nullptr;
+	#endif
+	// Select an instance of the default shader
+	if (!(filter == Filter::Alpha && almostZero(colors.alpha))) {
+		bool hasVertexFade = !(almostSame(colors.red) && almostSame(colors.green) && almostSame(colors.blue) && almostSame(colors.alpha));
+		bool colorless = almostOne(colors.red) && almostOne(colors.green) && almostOne(colors.blue) && almostOne(colors.alpha);
+		// Get the function pointer to the correct shader
+		DRAW_CALLBACK_TYPE drawTask = &drawCallbackTemplate;
+		if (diffuse) {
+			bool hasDiffusePyramid = diffuse->texture.hasMipBuffer();
+			if (light) {
+				if (hasVertexFade) { // DiffuseLightVertex
+					if (hasDiffusePyramid) { // With mipmap
+						drawTask = &(Shader_RgbaMultiply<true, true, true, false, false>::processTriangle);
+					} else { // Without mipmap
+						drawTask = &(Shader_RgbaMultiply<true, true, true, false, true>::processTriangle);
+					}
+				} else { // DiffuseLight
+					if (hasDiffusePyramid) { // With mipmap
+						drawTask = &(Shader_RgbaMultiply<true, true, false, false, false>::processTriangle);
+					} else { // Without mipmap
+						drawTask = &(Shader_RgbaMultiply<true, true, false, false, true>::processTriangle);
+					}
+				}
+			} else {
+				if (hasVertexFade) { // DiffuseVertex
+					if (hasDiffusePyramid) { // With mipmap
+						drawTask = &(Shader_RgbaMultiply<true, false, true, false, false>::processTriangle);
+					} else { // Without mipmap
+						drawTask = &(Shader_RgbaMultiply<true, false, true, false, true>::processTriangle);
+					}
+				} else {
+					if (colorless) { // Diffuse without normalization
 						if (hasDiffusePyramid) { // With mipmap
-							drawTask = &(Shader_RgbaMultiply<true, true, true, false, false>::processTriangle);
+							drawTask = &(Shader_RgbaMultiply<true, false, false, true, false>::processTriangle);
 						} else { // Without mipmap
-							drawTask = &(Shader_RgbaMultiply<true, true, true, false, true>::processTriangle);
+							drawTask = &(Shader_RgbaMultiply<true, false, false, true, true>::processTriangle);
 						}
-					} else { // DiffuseLight
+					} else { // Diffuse
 						if (hasDiffusePyramid) { // With mipmap
-							drawTask = &(Shader_RgbaMultiply<true, true, false, false, false>::processTriangle);
+							drawTask = &(Shader_RgbaMultiply<true, false, false, false, false>::processTriangle);
 						} else { // Without mipmap
-							drawTask = &(Shader_RgbaMultiply<true, true, false, false, true>::processTriangle);
+							drawTask = &(Shader_RgbaMultiply<true, false, false, false, true>::processTriangle);
 						}
 					}
+				}
+			}
+		} else {
+			if (light) {
+				if (hasVertexFade) { // LightVertex
+					drawTask = &(Shader_RgbaMultiply<false, true, true, false, false>::processTriangle);
 				} else {
-					if (hasVertexFade) { // DiffuseVertex
-						if (hasDiffusePyramid) { // With mipmap
-							drawTask = &(Shader_RgbaMultiply<true, false, true, false, false>::processTriangle);
-						} else { // Without mipmap
-							drawTask = &(Shader_RgbaMultiply<true, false, true, false, true>::processTriangle);
-						}
-					} else {
-						if (colorless) { // Diffuse without normalization
-							if (hasDiffusePyramid) { // With mipmap
-								drawTask = &(Shader_RgbaMultiply<true, false, false, true, false>::processTriangle);
-							} else { // Without mipmap
-								drawTask = &(Shader_RgbaMultiply<true, false, false, true, true>::processTriangle);
-							}
-						} else { // Diffuse
-							if (hasDiffusePyramid) { // With mipmap
-								drawTask = &(Shader_RgbaMultiply<true, false, false, false, false>::processTriangle);
-							} else { // Without mipmap
-								drawTask = &(Shader_RgbaMultiply<true, false, false, false, true>::processTriangle);
-							}
-						}
+					if (colorless) { // Light without normalization
+						drawTask = &(Shader_RgbaMultiply<false, true, false, true, false>::processTriangle);
+					} else { // Light
+						drawTask = &(Shader_RgbaMultiply<false, true, false, false, false>::processTriangle);
 					}
 				}
 			} else {
-				if (light) {
-					if (hasVertexFade) { // LightVertex
-						drawTask = &(Shader_RgbaMultiply<false, true, true, false, false>::processTriangle);
-					} else {
-						if (colorless) { // Light without normalization
-							drawTask = &(Shader_RgbaMultiply<false, true, false, true, false>::processTriangle);
-						} else { // Light
-							drawTask = &(Shader_RgbaMultiply<false, true, false, false, false>::processTriangle);
-						}
-					}
-				} else {
-					if (hasVertexFade) { // Vertex
-						drawTask = &(Shader_RgbaMultiply<false, false, true, false, false>::processTriangle);
-					} else { // Single color
-						drawTask = &(Shader_RgbaMultiply<false, false, false, false, false>::processTriangle);
-					}
+				if (hasVertexFade) { // Vertex
+					drawTask = &(Shader_RgbaMultiply<false, false, true, false, false>::processTriangle);
+				} else { // Single color
+					drawTask = &(Shader_RgbaMultiply<false, false, false, false, false>::processTriangle);
 				}
 			}
-			renderTriangleWithShader(commandQueue, TriangleDrawData(targetImage, depthBuffer, camera.perspective, filter, TriangleInput(diffuse, light, texCoords, colors), drawTask), camera, triangle, clipBound);
+		}
+		// Allow small triangles to be a bit outside of the view frustum without being clipped by using the extended clip frustum
+		impl_renderTriangleWithShader(commandQueue, TriangleDrawData(targetImage, depthBuffer, camera.perspective, filter, TriangleInput(diffuse, light, texCoords, colors), drawTask), camera, triangle, clipBound, getTriangleVisibility(outcodeA, outcodeB, outcodeC, true));
+	}
+}
+
+// Returns the closest depth, which is the lowest linear depth for orthogonal cameras and the highest reciprocal depth for perspective cameras
+template<bool AFFINE>
+static inline float getClosestDepth(float oldValue, float newValue) {
+	if (AFFINE) {
+		return newValue < oldValue ? newValue : oldValue;
+	} else {
+		return newValue > oldValue ? newValue : oldValue;
+	}
+}
+
+template<bool AFFINE>
+static inline F32x4 getClosestDepth(const F32x4 &oldValue, const F32x4 &newValue) {
+	if (AFFINE) {
+		return min(oldValue, newValue);
+	} else {
+		return max(oldValue, newValue);
+	}
+}
+
+// Draw depth for pixelCount pixels from depthData, starting with depthValue and increasing by depthDx per pixel.
+template<bool AFFINE>
+static inline void drawDepthSpan(SafePointer<float> depthData, int32_t pixelCount, float depthValue, float depthDx) {
+	int32_t x = 0;
+	// Draw single pixels until the vectors can be aligned with memory
+	while (x < pixelCount && ((uintptr_t)depthData.getUnsafe() & 15) != 0) {
+		*depthData = getClosestDepth<AFFINE>(*depthData, depthValue);
+		depthValue += depthDx;
+		depthData += 1;
+		x++;
+	}
+	// Draw 8 pixels at a time using two vectors
+	if (x + 8 <= pixelCount) {
+		// Each lane is offset from depthValue, so that rounding errors do not add up within a group of pixels
+		ALIGN16 F32x4 depthFirst = F32x4(depthValue) + F32x4(0.0f, depthDx, depthDx * 2.0f, depthDx * 3.0f);
+		ALIGN16 F32x4 depthSecond = depthFirst + (depthDx * 4.0f);
+		float depthDx8 = depthDx * 8.0f;
+		for (; x + 8 <= pixelCount; x += 8) {
+			ALIGN16 F32x4 oldFirst = F32x4::readAligned(depthData, "drawDepthSpan @ read first");
+			ALIGN16 F32x4 oldSecond = F32x4::readAligned(depthData + 4, "drawDepthSpan @ read second");
+			getClosestDepth<AFFINE>(oldFirst, depthFirst).writeAligned(depthData, "drawDepthSpan @ write first");
+			getClosestDepth<AFFINE>(oldSecond, depthSecond).writeAligned(depthData + 4, "drawDepthSpan @ write second");
+			depthFirst = depthFirst + depthDx8;
+			depthSecond = depthSecond + depthDx8;
+			depthData += 8;
+		}
+		depthValue = depthFirst.get().x;
+	}
+	// Draw the remaining pixels
+	for (; x < pixelCount; x++) {
+		*depthData = getClosestDepth<AFFINE>(*depthData, depthValue);
+		depthValue += depthDx;
+		depthData += 1;
+	}
+}
+
+// Draw quantized depth for pixelCount pixels from depthData, where higher values are closer with any projection.
+static inline void drawQuantizedDepthSpan(SafePointer<uint16_t> depthData, int32_t pixelCount, float depthValue, float depthDx, const DepthTarget &depthBuffer) {
+	for (int32_t x = 0; x < pixelCount; x++) {
+		// Each pixel is offset from depthValue, so that rounding errors do not add up along the span
+		uint16_t newValue = depthBuffer.quantize(depthValue + depthDx * x);
+		if (newValue > depthData[x]) {
+			depthData[x] = newValue;
 		}
 	}
 }
 
+// The depth written is depthScale times the triangle's depth plus depthOffset, which can be used to write depth slightly further away.
 template<bool AFFINE>
-static void executeTriangleDrawingDepth(ImageF32Impl *depthBuffer, const ITriangle2D& triangle, const IRect &clipBound) {
+static void executeTriangleDrawingDepth(const DepthTarget &depthBuffer, const ITriangle2D& triangle, const IRect &clipBound, float depthScale = 1.0f, float depthOffset = 0.0f) {
 	int32_t rowCount = triangle.getBufferSize(clipBound, 1, 1);
 	if (rowCount > 0) {
 		int startRow;
-		RowInterval rows[rowCount];
-		triangle.getShape(startRow, rows, clipBound, 1, 1);
-		Projection projection = triangle.getProjection(FVector3D(), FVector3D(), !AFFINE); // TODO: Create a weight using only depth to save time
-		RowShape shape = RowShape(startRow, rowCount, rows);
+		ArenaArray<RowInterval> rows(rowCount);
+		triangle.getShape(startRow, rows.getUnsafe(), clipBound, 1, 1);
+		// Only the depth is needed, so no vertex weights are calculated
+		DepthPlane plane = triangle.getDepthPlane(!AFFINE);
+		RowShape shape = RowShape(startRow, rowCount, rows.getUnsafe());
+		float depthDx = plane.depthDx * depthScale;
 		// Draw the triangle
-		const int depthBufferStride = imageInternal::getStride(depthBuffer);
-		SafePointer<float> depthDataRow = imageInternal::getSafeData<float>(depthBuffer, shape.startRow);
 		for (int32_t y = shape.startRow; y < shape.startRow + shape.rowCount; y++) {
 			RowInterval row = shape.rows[y - shape.startRow];
-			SafePointer<float> depthData = depthDataRow + row.left;
-			// Initialize depth iteration
-			float depthValue;
-			if (AFFINE) {
-				depthValue = projection.getWeight_affine(IVector2D(row.left, y)).x;
-			} else {
-				depthValue = projection.getDepthDividedWeight_perspective(IVector2D(row.left, y)).x;
-			}
-			float depthDx = projection.pWeightDx.x;
-			// Loop over a row of depth pixels
-			for (int32_t x = row.left; x < row.right; x++) {
-				float oldValue = *depthData;
-				if (AFFINE) {
-					// Write lower depthValue for orthogonal cameras
-					if (depthValue < oldValue) {
-						*depthData = depthValue;
-					}
+			if (row.right > row.left) {
+				float depthValue = plane.getDepth(IVector2D(row.left, y)) * depthScale + depthOffset;
+				if (depthBuffer.quantized) {
+					drawQuantizedDepthSpan(imageInternal::getSafeData<uint16_t>(depthBuffer.image, y) + row.left, row.right - row.left, depthValue, depthDx, depthBuffer);
 				} else {
-					// Write higher depthValue for perspective cameras
-					if (depthValue > oldValue) {
-						*depthData = depthValue;
-					}
+					drawDepthSpan<AFFINE>(imageInternal::getSafeData<float>(depthBuffer.image, y) + row.left, row.right - row.left, depthValue, depthDx);
 				}
-				depthValue += depthDx;
-				depthData += 1;
 			}
-			// Iterate to the next row
-			depthDataRow.increaseBytes(depthBufferStride);
 		}
 	}
 }
 
-static void drawTriangleDepth(ImageF32Impl *depthBuffer, const Camera &camera, const IRect &clipBound, const ITriangle2D& triangle) {
+static void drawTriangleDepth(const DepthTarget &depthBuffer, const Camera &camera, const IRect &clipBound, const ITriangle2D& triangle) {
 	// Rounding sub-triangles to integer locations may reverse the direction of zero area triangles
 	if (triangle.isFrontfacing()) {
 		if (camera.perspective) {
@@ -474,26 +521,31 @@ static void drawTriangleDepth(ImageF32Impl *depthBuffer, const Camera &camera, c
 	}
 }
 
-static void drawSubTriangleDepth(ImageF32Impl *depthBuffer, const Camera &camera, const IRect &clipBound, const SubVertex &vertexA, const SubVertex &vertexB, const SubVertex &vertexC) {
+static void drawSubTriangleDepth(const DepthTarget &depthBuffer, const Camera &camera, const IRect &clipBound, const SubVertex &vertexA, const SubVertex &vertexB, const SubVertex &vertexC) {
 	ProjectedPoint posA = camera.cameraToScreen(vertexA.cs);
 	ProjectedPoint posB = camera.cameraToScreen(vertexB.cs);
 	ProjectedPoint posC = camera.cameraToScreen(vertexC.cs);
 	drawTriangleDepth(depthBuffer, camera, clipBound, ITriangle2D(posA, posB, posC));
 }
 
-void dsr::renderTriangleFromDataDepth(ImageF32Impl *depthBuffer, const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC) {
+void dsr::renderTriangleFromDataDepth(const DepthTarget &depthBuffer, const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC) {
+	renderTriangleFromDataDepth(depthBuffer, camera, posA, posB, posC, camera.getOutcode(posA.cs), camera.getOutcode(posB.cs), camera.getOutcode(posC.cs));
+}
+
+void dsr::renderTriangleFromDataDepth(
+  const DepthTarget &depthBuffer, const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC,
+  uint32_t outcodeA, uint32_t outcodeB, uint32_t outcodeC) {
 	// Skip rendering if there's no target buffer
-	if (depthBuffer == nullptr) { return; }
-	// Select a bound
-	IRect clipBound = IRect::FromSize(imageInternal::getWidth(depthBuffer), imageInternal::getHeight(depthBuffer));
-	// Create a triangle
-	ITriangle2D triangle(posA, posB, posC);
+	if (!depthBuffer.exists()) { return; }
 	// Only draw visible triangles
-	Visibility visibility = getTriangleVisibility(triangle, camera, false);
-	if (visibility != Visibility::Hidden) {
+	if (getTriangleVisibility(outcodeA, outcodeB, outcodeC, false) != Visibility::Hidden) {
+		// Select a bound
+		IRect clipBound = IRect::FromSize(imageInternal::getWidth(depthBuffer.image), imageInternal::getHeight(depthBuffer.image));
+		// Create a triangle
+		ITriangle2D triangle(posA, posB, posC);
 		// Allow small triangles to be a bit outside of the view frustum without being clipped by increasing the width and height slopes in a second test
 		// This reduces redundant clipping to improve both speed and quality
-		Visibility paddedVisibility = getTriangleVisibility(triangle, camera, true);
+		Visibility paddedVisibility = getTriangleVisibility(outcodeA, outcodeB, outcodeC, true);
 		// Draw the triangle
 		if (paddedVisibility == Visibility::Full) {
 			// Only check if the triangle is front facing once we know that the projection is in positive depth
@@ -519,44 +571,505 @@ void dsr::renderTriangleFromDataDepth(ImageF32Impl *depthBuffer, const Camera &c
 	}
 }
 
-void CommandQueue::add(const TriangleDrawCommand &command) {
-	this->buffer.push(command);
+// Returns true iff each row of image starts 16-byte aligned, so that groups of pixels can be accessed using aligned SIMD vectors
+static bool impl_isRowAligned(const ImageImpl &image) {
+	return (image.stride & 15) == 0 && ((uintptr_t)(imageInternal::getSafeData<uint8_t>(image).getUnsafe()) & 15) == 0;
+}
+
+template<typename T>
+static void impl_expandSamples(ImageImpl &samples, const ImageImpl &pixels) {
+	int width = std::min(pixels.width, samples.width / 2);
+	int height = std::min(pixels.height, samples.height / 2);
+	threadedSplit(0, height, [&samples, &pixels, width](int startY, int stopY) {
+		for (int y = startY; y < stopY; y++) {
+			const SafePointer<T> pixelRow = imageInternal::getSafeData<T>(pixels, y);
+			SafePointer<T> upperSampleRow = imageInternal::getSafeData<T>(samples, y * 2);
+			SafePointer<T> lowerSampleRow = imageInternal::getSafeData<T>(samples, y * 2 + 1);
+			for (int x = 0; x < width; x++) {
+				T value = pixelRow[x];
+				upperSampleRow[x * 2] = value;
+				upperSampleRow[x * 2 + 1] = value;
+				lowerSampleRow[x * 2] = value;
+				lowerSampleRow[x * 2 + 1] = value;
+			}
+		}
+	}, 16);
+}
+
+// Writes two pixels at a time as four samples on each row, using aligned vectors when the sample image is aligned.
+static void impl_expandColorSamples(ImageRgbaU8Impl &samples, const ImageRgbaU8Impl &pixels) {
+	if (!impl_isRowAligned(samples)) {
+		impl_expandSamples<uint32_t>(samples, pixels);
+		return;
+	}
+	int width = std::min(pixels.width, samples.width / 2);
+	int height = std::min(pixels.height, samples.height / 2);
+	threadedSplit(0, height, [&samples, &pixels, width](int startY, int stopY) {
+		for (int y = startY; y < stopY; y++) {
+			const SafePointer<uint32_t> pixelRow = imageInternal::getSafeData<uint32_t>(pixels, y);
+			SafePointer<uint32_t> upperSampleRow = imageInternal::getSafeData<uint32_t>(samples, y * 2);
+			SafePointer<uint32_t> lowerSampleRow = imageInternal::getSafeData<uint32_t>(samples, y * 2 + 1);
+			int x = 0;
+			for (; x + 1 < width; x += 2) {
+				uint32_t left = pixelRow[x];
+				uint32_t right = pixelRow[x + 1];
+				U32x4 fourSamples = U32x4(left, left, right, right);
+				fourSamples.writeAligned(upperSampleRow + x * 2, "impl_expandColorSamples @ upper samples");
+				fourSamples.writeAligned(lowerSampleRow + x * 2, "impl_expandColorSamples @ lower samples");
+			}
+			// An odd width leaves one pixel
+			for (; x < width; x++) {
+				uint32_t value = pixelRow[x];
+				upperSampleRow[x * 2] = value;
+				upperSampleRow[x * 2 + 1] = value;
+				lowerSampleRow[x * 2] = value;
+				lowerSampleRow[x * 2 + 1] = value;
+			}
+		}
+	}, 16);
+}
+
+void dsr::expandSamples(ImageRgbaU8Impl *sampleColorBuffer, ImageImpl *sampleDepthBuffer, const ImageRgbaU8Impl *colorBuffer, const ImageImpl *depthBuffer) {
+	if (sampleColorBuffer != nullptr && colorBuffer != nullptr) {
+		impl_expandColorSamples(*sampleColorBuffer, *colorBuffer);
+	}
+	if (sampleDepthBuffer != nullptr && depthBuffer != nullptr) {
+		assert(sampleDepthBuffer->pixelSize == depthBuffer->pixelSize);
+		if (depthBuffer->pixelSize == 2) {
+			impl_expandSamples<uint16_t>(*sampleDepthBuffer, *depthBuffer);
+		} else {
+			impl_expandSamples<float>(*sampleDepthBuffer, *depthBuffer);
+		}
+	}
+}
+
+// Returns the rounded average of four packed colors, by adding two channels at a time in 16-bit halves of a 32-bit integer.
+//   The result does not depend on the pack order, because all four channels are treated the same.
+static inline uint32_t averageColors(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+	const uint32_t mask = 0x00FF00FFu;
+	const uint32_t rounding = 0x00020002u;
+	uint32_t even = (a & mask) + (b & mask) + (c & mask) + (d & mask) + rounding;
+	uint32_t odd = ((a >> 8) & mask) + ((b >> 8) & mask) + ((c >> 8) & mask) + ((d >> 8) & mask) + rounding;
+	return ((even >> 2) & mask) | (((odd >> 2) & mask) << 8);
+}
+
+// Returns the 16-bit channel sums of two pixels, from four samples on the upper and lower sample rows.
+//   The first pixel's sums are in the lower four lanes and the second pixel's sums are in the upper four lanes.
+static inline U16x8 sumSamplePairs(const U8x16 &upperSamples, const U8x16 &lowerSamples) {
+	// Vertical sums with the left and right samples of the first pixel in leftSums and of the second pixel in rightSums
+	U16x8 leftSums = lowerToU16(upperSamples) + lowerToU16(lowerSamples);
+	U16x8 rightSums = higherToU16(upperSamples) + higherToU16(lowerSamples);
+	// Add the right samples to the left samples in the lower four lanes
+	U16x8 leftPixel = leftSums + vectorExtract_4(leftSums, rightSums);
+	U16x8 rightPixel = rightSums + vectorExtract_4(rightSums, leftSums);
+	// Combine the lower four lanes of both pixels
+	return vectorExtract_4(vectorExtract_4(rightPixel, leftPixel), rightPixel);
 }
 
+// Averages 2x2 samples four pixels at a time when both images are aligned, using 16-bit channel sums.
+static void impl_resolveColorSamples(ImageRgbaU8Impl &pixels, const ImageRgbaU8Impl &samples) {
+	int width = std::min(pixels.width, samples.width / 2);
+	int height = std::min(pixels.height, samples.height / 2);
+	bool aligned = impl_isRowAligned(pixels) && impl_isRowAligned(samples);
+	threadedSplit(0, height, [&pixels, &samples, width, aligned](int startY, int stopY) {
+		for (int y = startY; y < stopY; y++) {
+			int x = 0;
+			if (aligned) {
+				SafePointer<uint8_t> pixelBytes = imageInternal::getSafeData<uint8_t>(pixels, y);
+				const SafePointer<uint8_t> upperSampleBytes = imageInternal::getSafeData<uint8_t>(samples, y * 2);
+				const SafePointer<uint8_t> lowerSampleBytes = imageInternal::getSafeData<uint8_t>(samples, y * 2 + 1);
+				for (; x + 3 < width; x += 4) {
+					// Four pixels have 16 bytes and their samples have 32 bytes on each sample row
+					U16x8 leftSums = sumSamplePairs(
+					  U8x16::readAligned(upperSampleBytes + x * 8, "impl_resolveColorSamples @ upper left samples"),
+					  U8x16::readAligned(lowerSampleBytes + x * 8, "impl_resolveColorSamples @ lower left samples"));
+					U16x8 rightSums = sumSamplePairs(
+					  U8x16::readAligned(upperSampleBytes + x * 8 + 16, "impl_resolveColorSamples @ upper right samples"),
+					  U8x16::readAligned(lowerSampleBytes + x * 8 + 16, "impl_resolveColorSamples @ lower right samples"));
+					U8x16 averages = saturateToU8((leftSums + (uint16_t)2) >> 2, (rightSums + (uint16_t)2) >> 2);
+					averages.writeAligned(pixelBytes + x * 4, "impl_resolveColorSamples @ pixels");
+				}
+			}
+			// Pixels that did not fill a whole vector
+			SafePointer<uint32_t> pixelRow = imageInternal::getSafeData<uint32_t>(pixels, y);
+			const SafePointer<uint32_t> upperSampleRow = imageInternal::getSafeData<uint32_t>(samples, y * 2);
+			const SafePointer<uint32_t> lowerSampleRow = imageInternal::getSafeData<uint32_t>(samples, y * 2 + 1);
+			for (; x < width; x++) {
+				pixelRow[x] = averageColors(upperSampleRow[x * 2], upperSampleRow[x * 2 + 1], lowerSampleRow[x * 2], lowerSampleRow[x * 2 + 1]);
+			}
+		}
+	}, 16);
+}
+
+// Averaging depth would create depths belonging to none of the triangles along edges, so the upper left sample is used
+template<typename T>
+static void impl_resolveDepth(ImageImpl &pixels, const ImageImpl &samples) {
+	int width = std::min(pixels.width, samples.width / 2);
+	int height = std::min(pixels.height, samples.height / 2);
+	threadedSplit(0, height, [&pixels, &samples, width](int startY, int stopY) {
+		for (int y = startY; y < stopY; y++) {
+			SafePointer<T> pixelRow = imageInternal::getSafeData<T>(pixels, y);
+			const SafePointer<T> sampleRow = imageInternal::getSafeData<T>(samples, y * 2);
+			for (int x = 0; x < width; x++) {
+				pixelRow[x] = sampleRow[x * 2];
+			}
+		}
+	}, 16);
+}
+
+void dsr::resolveSamples(ImageRgbaU8Impl *colorBuffer, ImageImpl *depthBuffer, const ImageRgbaU8Impl *sampleColorBuffer, const ImageImpl *sampleDepthBuffer) {
+	if (colorBuffer != nullptr && sampleColorBuffer != nullptr) {
+		impl_resolveColorSamples(*colorBuffer, *sampleColorBuffer);
+	}
+	if (depthBuffer != nullptr && sampleDepthBuffer != nullptr) {
+		assert(depthBuffer->pixelSize == sampleDepthBuffer->pixelSize);
+		if (depthBuffer->pixelSize == 2) {
+			impl_resolveDepth<uint16_t>(*depthBuffer, *sampleDepthBuffer);
+		} else {
+			impl_resolveDepth<float>(*depthBuffer, *sampleDepthBuffer);
+		}
+	}
+}
+
+template<typename T>
+static void impl_resampleDepth(ImageImpl &target, const ImageImpl &source) {
+	for (int y = 0; y < target.height; y++) {
+		int sourceY = (int)(((int64_t)y * 2 + 1) * source.height / ((int64_t)target.height * 2));
+		SafePointer<T> targetRow = imageInternal::getSafeData<T>(target, y);
+		const SafePointer<T> sourceRow = imageInternal::getSafeData<T>(source, sourceY);
+		for (int x = 0; x < target.width; x++) {
+			targetRow[x] = sourceRow[(int)(((int64_t)x * 2 + 1) * source.width / ((int64_t)target.width * 2))];
+		}
+	}
+}
+
+void dsr::resampleDepth(ImageImpl *depthBuffer, const ImageImpl *sourceDepthBuffer) {
+	if (depthBuffer != nullptr && sourceDepthBuffer != nullptr) {
+		assert(depthBuffer->pixelSize == sourceDepthBuffer->pixelSize);
+		if (depthBuffer->pixelSize == 2) {
+			impl_resampleDepth<uint16_t>(*depthBuffer, *sourceDepthBuffer);
+		} else {
+			impl_resampleDepth<float>(*depthBuffer, *sourceDepthBuffer);
+		}
+	}
+}
+
+TriangleDrawHeader::TriangleDrawHeader(const TriangleDrawCommand &command, int32_t stateIndex)
+: bound(IRect::cut(command.clipBound, command.triangle.wholeBound)), stateIndex(stateIndex), occluded(false) {
+	float depthA = command.triangle.position[0].cs.z;
+	float depthB = command.triangle.position[1].cs.z;
+	float depthC = command.triangle.position[2].cs.z;
+	this->nearDepth = std::min(std::min(depthA, depthB), depthC);
+	this->farDepth = std::max(std::max(depthA, depthB), depthC);
+}
+
+void CommandQueue::add(const TriangleDrawData &triangleDrawData, const TriangleDrawCommand &command) {
+	// Triangles are usually given one model part at a time, so comparing with the last state finds most of the shared states
+	if (this->states.length() == 0 || !this->states.last().matches(triangleDrawData)) {
+		this->states.push(TriangleDrawState(triangleDrawData));
+	}
+	this->headers.push(TriangleDrawHeader(command, this->states.length() - 1));
+	this->commands.push(command);
+}
+
+void CommandQueue::append(CommandQueue &source) {
+	int64_t sourceCount = source.length();
+	if (sourceCount > 0) {
+		int32_t stateOffset = this->states.length();
+		for (int64_t s = 0; s < source.states.length(); s++) {
+			this->states.push(source.states[s]);
+		}
+		this->headers.reserve(this->headers.length() + sourceCount);
+		this->commands.reserve(this->commands.length() + sourceCount);
+		for (int64_t i = 0; i < sourceCount; i++) {
+			TriangleDrawHeader header = source.headers[i];
+			header.stateIndex += stateOffset;
+			this->headers.push(header);
+			this->commands.push(source.commands[i]);
+		}
+		source.clear();
+	}
+}
+
+// Tiles are 64x64 pixels starting from multiples of 64, so that no pair of rows, 2x2 pixel quad or 8x8 depth hierarchy block is shared between tiles
+static const int tileSizeLog2 = 6;
+static const int tileSize = 1 << tileSizeLog2;
+// Each binning job should have enough triangles to be worth starting
+static const int minimumCommandsPerBinningJob = 256;
+
+// The range of tiles touched by a triangle, from inclusive first to exclusive end
+struct TileRange {
+	int32_t firstX, firstY, endX, endY;
+};
+
+// Building the depth hierarchy reads the whole depth buffer, so it is only done when there are enough triangles to gain from it
+static const int minimumCommandsForDepthHierarchy = 64;
+
+// Returns a 16-bit key for drawing triangles in DrawOrder::Depth when sorted in ascending order.
+//   Solid triangles come first, from front to back by their nearest corner.
+//   Other filters come last, from back to front by their farthest corner.
+static uint16_t getDepthSortKey(const TriangleDrawHeader &header, const TriangleDrawState &state) {
+	bool solid = state.filter == Filter::Solid;
+	float depth = solid ? header.nearDepth : header.farDepth;
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(uint32_t));
+	// Flip the bits so that the unsigned order is the same as the floating-point order, including negative depth from orthogonal cameras
+	bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+	// Quantize to 15 bits and place solid triangles before other filters
+	uint16_t quantized = (uint16_t)(bits >> 17);
+	return solid ? quantized : (uint16_t)(0xFFFFu - quantized);
+}
+
+// Stable radix sort of indices, using two passes over the bytes of each index's key.
+//   temporary must have room for count indices.
+static void sortIndicesByKey(int32_t *indices, int32_t *temporary, int32_t count, const uint16_t *keys) {
+	int32_t *source = indices;
+	int32_t *target = temporary;
+	for (int shift = 0; shift < 16; shift += 8) {
+		int32_t offsets[256] = {};
+		for (int32_t i = 0; i < count; i++) {
+			offsets[(keys[source[i]] >> shift) & 255]++;
+		}
+		int32_t offset = 0;
+		for (int b = 0; b < 256; b++) {
+			int32_t bucketCount = offsets[b];
+			offsets[b] = offset;
+			offset += bucketCount;
+		}
+		for (int32_t i = 0; i < count; i++) {
+			int32_t index = source[i];
+			target[offsets[(keys[index] >> shift) & 255]++] = index;
+		}
+		std::swap(source, target);
+	}
+	// After an even number of passes, the result is back in indices
+}
+
+// How far behind a triangle the depth pre-pass writes its depth, relative to the depth.
+//   Must be larger than the difference in rounding between executeTriangleDrawingDepth and the pixel shaders,
+//   so that the closest triangle passes the depth test again when shaded.
+//   Triangles within this distance behind the closest triangle may also be shaded.
+static const float prePassDepthMargin = 1.0f / 1024.0f;
+
+// The first phase of the depth pre-pass, writing the depth of solid triangles without shading.
+static void executeTriangleDrawingPrePass(const TriangleDrawState &state, const TriangleDrawCommand &command, const IRect &clipBound) {
+	if (state.filter == Filter::Solid && state.depthBuffer.exists()) {
+		IRect finalClipBound = IRect::cut(command.clipBound, clipBound);
+		if (state.perspective) {
+			// A lower reciprocal depth is further away
+			executeTriangleDrawingDepth<false>(state.depthBuffer, command.triangle, finalClipBound, 1.0f - prePassDepthMargin, 0.0f);
+		} else {
+			// Linear depth may cross zero for orthogonal cameras, so the margin is taken from the largest depth in the triangle
+			float largestDepth = 0.0f;
+			for (int c = 0; c < 3; c++) {
+				float depth = std::fabs(command.triangle.position[c].cs.z);
+				if (depth > largestDepth) { largestDepth = depth; }
+			}
+			executeTriangleDrawingDepth<true>(state.depthBuffer, command.triangle, finalClipBound, 1.0f, largestDepth * prePassDepthMargin);
+		}
+	}
+}
+
+// Draws the queue's commands at the given indices within clipBound.
+//   With the queue's depthPrePass, the depth of all solid triangles is written before any pixel is shaded.
+//   With statistics, the shaded pixels are counted.
+static void drawCommandList(const CommandQueue &queue, const int32_t *indices, int32_t count, const IRect &clipBound, DepthHierarchy *depthHierarchy, RenderStatistics *statistics) {
+	if (queue.depthPrePass) {
+		for (int32_t i = 0; i < count; i++) {
+			int32_t index = indices[i];
+			executeTriangleDrawingPrePass(queue.states[queue.headers[index].stateIndex], queue.commands[index], clipBound);
+		}
+	}
+	for (int32_t i = 0; i < count; i++) {
+		int32_t index = indices[i];
+		executeTriangleDrawing(queue.states[queue.headers[index].stateIndex], queue.commands[index], clipBound, depthHierarchy, queue.multisampled, statistics);
+	}
+}
+
+static void executeCommands(const CommandQueue &queue, const IRect &clipBound, int jobCount, DepthHierarchy *depthHierarchy);
+
 void CommandQueue::execute(const IRect &clipBound, int jobCount) const {
-	if (jobCount <= 1) {
-		// TODO: Make a setting for sorting triangles using indices within each job
-		for (int i = 0; i < this->buffer.length(); i++) {
-			if (!this->buffer[i].occluded) {
-				executeTriangleDrawing(this->buffer[i], clipBound);
+	double startTime = this->statistics ? time_getSeconds() : 0.0;
+	// The depth hierarchy can be used if all triangles are drawn to the same depth buffer with the same projection
+	DepthTarget sharedDepthBuffer;
+	bool sharedPerspective = false;
+	bool shared = this->length() >= minimumCommandsForDepthHierarchy;
+	for (int s = 0; s < this->states.length() && shared; s++) {
+		const TriangleDrawState &state = this->states[s];
+		if (s == 0) {
+			sharedDepthBuffer = state.depthBuffer;
+			sharedPerspective = state.perspective;
+		} else if (state.depthBuffer != sharedDepthBuffer || state.perspective != sharedPerspective) {
+			shared = false;
+		}
+	}
+	if (shared && sharedDepthBuffer.exists()) {
+		DepthHierarchy depthHierarchy(sharedDepthBuffer, sharedPerspective);
+		executeCommands(*this, clipBound, jobCount, &depthHierarchy);
+	} else {
+		executeCommands(*this, clipBound, jobCount, nullptr);
+	}
+	if (this->statistics) {
+		this->statistics->executeSeconds += time_getSeconds() - startTime;
+	}
+}
+
+// Adds a job's time to the statistics
+static void addJobTime(RenderStatistics &statistics, double seconds) {
+	statistics.jobCount++;
+	statistics.jobSeconds += seconds;
+	if (seconds > statistics.slowestJobSeconds) {
+		statistics.slowestJobSeconds = seconds;
+	}
+}
+
+static void executeCommands(const CommandQueue &queue, const IRect &clipBound, int jobCount, DepthHierarchy *depthHierarchy) {
+	const List<TriangleDrawHeader> &headers = queue.headers;
+	const List<TriangleDrawState> &states = queue.states;
+	RenderStatistics *statistics = queue.statistics;
+	int commandCount = queue.length();
+	bool sortByDepth = queue.drawOrder == DrawOrder::Depth && commandCount > 1;
+	// Tile indices are relative to the first tile in clipBound
+	int firstTileX = clipBound.left() >> tileSizeLog2;
+	int firstTileY = clipBound.top() >> tileSizeLog2;
+	int tileCountX = ((clipBound.right() + tileSize - 1) >> tileSizeLog2) - firstTileX;
+	int tileCountY = ((clipBound.bottom() + tileSize - 1) >> tileSizeLog2) - firstTileY;
+	int tileCount = tileCountX * tileCountY;
+	if (jobCount <= 1 || tileCount <= 1 || commandCount == 0 || !clipBound.hasArea()) {
+		double startTime = statistics ? time_getSeconds() : 0.0;
+		ArenaArray<uint16_t> sortKeys(sortByDepth ? commandCount : 0);
+		ArenaArray<int32_t> order(commandCount);
+		int32_t visibleCount = 0;
+		for (int i = 0; i < commandCount; i++) {
+			if (!headers[i].occluded) {
+				if (sortByDepth) {
+					sortKeys[i] = getDepthSortKey(headers[i], states[headers[i].stateIndex]);
+				}
+				order[visibleCount] = i;
+				visibleCount++;
 			}
 		}
+		if (sortByDepth) {
+			ArenaArray<int32_t> temporary(visibleCount);
+			sortIndicesByKey(order.getUnsafe(), temporary.getUnsafe(), visibleCount, sortKeys.getUnsafe());
+		}
+		drawCommandList(queue, order.getUnsafe(), visibleCount, clipBound, depthHierarchy, statistics);
+		if (statistics) {
+			statistics->trianglesDrawn += visibleCount;
+			addJobTime(*statistics, time_getSeconds() - startTime);
+		}
 	} else {
-		std::function<void()> jobs[jobCount];
-		int y1 = clipBound.top();
-		for (int j = 0; j < jobCount; j++) {
-			int y2 = clipBound.top() + ((clipBound.bottom() * (j + 1)) / jobCount);
-			// Align to multiples of two lines if it's not at the bottom
-			if (j < jobCount - 1) {
-				y2 = (y2 / 2) * 2;
+		// Instead of letting every thread go through all triangles, each triangle is listed in the tiles it touches.
+		//   The command list is split into binning jobs, which first count and then write their triangles for each tile.
+		//   A tile's list contains the triangles of each binning job in the order of the jobs, so the draw order is preserved.
+		int binningJobCount = commandCount / minimumCommandsPerBinningJob;
+		if (binningJobCount > jobCount) { binningJobCount = jobCount; }
+		if (binningJobCount < 1) { binningJobCount = 1; }
+		// The temporary memory is reused from the calling thread's arena in the next frame
+		ArenaArray<TileRange> tileRanges(commandCount);
+		// The number of triangles in each tile from each binning job, which is later turned into write offsets
+		ArenaArray<int32_t> binOffsets(tileCount * binningJobCount);
+		for (int i = 0; i < binOffsets.length(); i++) {
+			binOffsets[i] = 0;
+		}
+		// Where each tile's list of triangles starts, with an extra element for the end of the last tile
+		ArenaArray<int32_t> tileStarts(tileCount + 1);
+		// Depth keys for sorting the triangles within each tile, or empty when keeping the submitted order
+		ArenaArray<uint16_t> sortKeys(sortByDepth ? commandCount : 0);
+		auto getBinningInterval = [commandCount, binningJobCount](int jobIndex, int &first, int &end) {
+			first = (int)(((int64_t)commandCount * jobIndex) / binningJobCount);
+			end = (int)(((int64_t)commandCount * (jobIndex + 1)) / binningJobCount);
+		};
+		// Find the tiles touched by each triangle and count them
+		threadedWorkByIndex([&headers, &states, &clipBound, &tileRanges, &binOffsets, &sortKeys, &getBinningInterval, firstTileX, firstTileY, tileCountX, binningJobCount, sortByDepth](int jobIndex) {
+			int first, end;
+			getBinningInterval(jobIndex, first, end);
+			for (int i = first; i < end; i++) {
+				const TriangleDrawHeader &header = headers[i];
+				TileRange &range = tileRanges[i];
+				IRect bound = IRect::cut(header.bound, clipBound);
+				if (header.occluded || !bound.hasArea()) {
+					range = TileRange{0, 0, 0, 0};
+				} else {
+					range.firstX = (bound.left() >> tileSizeLog2) - firstTileX;
+					range.firstY = (bound.top() >> tileSizeLog2) - firstTileY;
+					range.endX = ((bound.right() - 1) >> tileSizeLog2) - firstTileX + 1;
+					range.endY = ((bound.bottom() - 1) >> tileSizeLog2) - firstTileY + 1;
+					if (sortByDepth) {
+						sortKeys[i] = getDepthSortKey(header, states[header.stateIndex]);
+					}
+					for (int y = range.firstY; y < range.endY; y++) {
+						for (int x = range.firstX; x < range.endX; x++) {
+							binOffsets[(x + y * tileCountX) * binningJobCount + jobIndex]++;
+						}
+					}
+				}
+			}
+		}, binningJobCount);
+		// Turn the counts into offsets in one array, ordered by tile and then by binning job
+		int32_t offset = 0;
+		for (int t = 0; t < tileCount; t++) {
+			tileStarts[t] = offset;
+			for (int j = 0; j < binningJobCount; j++) {
+				int32_t count = binOffsets[t * binningJobCount + j];
+				binOffsets[t * binningJobCount + j] = offset;
+				offset += count;
 			}
-			int height = y2 - y1;
-			IRect subBound = IRect(clipBound.left(), y1, clipBound.width(), height);
-			jobs[j] = [this, subBound]() {
-				//this->execute(subBound, 1);
-				for (int i = 0; i < this->buffer.length(); i++) {
-					if (!this->buffer[i].occluded) {
-						executeTriangleDrawing(this->buffer[i], subBound);
+		}
+		tileStarts[tileCount] = offset;
+		// Write the triangle indices to each tile's list
+		ArenaArray<int32_t> tileCommands(offset);
+		threadedWorkByIndex([&tileRanges, &binOffsets, &tileCommands, &getBinningInterval, tileCountX, binningJobCount](int jobIndex) {
+			int first, end;
+			getBinningInterval(jobIndex, first, end);
+			for (int i = first; i < end; i++) {
+				const TileRange &range = tileRanges[i];
+				for (int y = range.firstY; y < range.endY; y++) {
+					for (int x = range.firstX; x < range.endX; x++) {
+						tileCommands[binOffsets[(x + y * tileCountX) * binningJobCount + jobIndex]++] = i;
 					}
 				}
-			};
-			y1 = y2;
+			}
+		}, binningJobCount);
+		// Draw the tiles, where threads running out of tiles take over tiles from busy threads
+		// Each tile completes its own depth pre-pass before shading, because no other tile can write to its pixels
+		// Each tile counts into its own statistics, which are added together when all tiles are done
+		ArenaArray<RenderStatistics> tileStatistics(statistics ? tileCount : 0);
+		threadedWorkByIndex([&queue, &clipBound, &tileStarts, &tileCommands, &sortKeys, &tileStatistics, depthHierarchy, firstTileX, firstTileY, tileCountX, sortByDepth, statistics](int tileIndex) {
+			double startTime = statistics ? time_getSeconds() : 0.0;
+			RenderStatistics *tileStatistic = statistics ? &(tileStatistics[tileIndex]) : nullptr;
+			int tileX = firstTileX + tileIndex % tileCountX;
+			int tileY = firstTileY + tileIndex / tileCountX;
+			IRect tileBound = IRect::cut(IRect(tileX << tileSizeLog2, tileY << tileSizeLog2, tileSize, tileSize), clipBound);
+			int32_t tileCommandCount = tileStarts[tileIndex + 1] - tileStarts[tileIndex];
+			if (sortByDepth && tileCommandCount > 1) {
+				// Each tile owns its part of tileCommands, so it can be sorted in place using the drawing thread's arena
+				ArenaArray<int32_t> temporary(tileCommandCount);
+				sortIndicesByKey(tileCommands.getUnsafe() + tileStarts[tileIndex], temporary.getUnsafe(), tileCommandCount, sortKeys.getUnsafe());
+			}
+			drawCommandList(queue, tileCommands.getUnsafe() + tileStarts[tileIndex], tileCommandCount, tileBound, depthHierarchy, tileStatistic);
+			if (tileStatistic) {
+				tileStatistic->jobSeconds = time_getSeconds() - startTime;
+			}
+		}, tileCount);
+		if (statistics) {
+			// Triangles are counted once even if drawn in multiple tiles
+			for (int i = 0; i < commandCount; i++) {
+				if (!headers[i].occluded) {
+					statistics->trianglesDrawn++;
+				}
+			}
+			for (int tileIndex = 0; tileIndex < tileCount; tileIndex++) {
+				statistics->pixelsShaded += tileStatistics[tileIndex].pixelsShaded;
+				addJobTime(*statistics, tileStatistics[tileIndex].jobSeconds);
+			}
 		}
-		threadedWorkFromArray(jobs, jobCount);
 	}
 }
 
 void CommandQueue::clear() {
-	this->buffer.clear();
+	this->headers.clear();
+	this->commands.clear();
+	this->states.clear();
 }
 
@@ -29,8 +29,12 @@
 #include "shader/Shader.h"
 #include "../image/ImageRgbaU8.h"
 #include "../image/ImageF32.h"
+#include "../image/ImageU16.h"
 #include "../base/threading.h"
 #include "../collection/List.h"
+#include "DepthHierarchy.h"
+#include "DepthTarget.h"
+#include "RenderStatistics.h"
 
 namespace dsr {
 
@@ -38,8 +42,9 @@ struct TriangleDrawData {
 	// Color target
 	ImageRgbaU8Impl *targetImage;
 	// Depth target
-	ImageF32Impl *depthBuffer;
+	DepthTarget depthBuffer;
 	// When perspective is used, the depth buffer stores 1 / depth instead of linear depth.
+	//   Quantized depth buffers store the same depth multiplied and offset by the depth target.
 	bool perspective;
 	// The target blending method
 	Filter filter;
@@ -47,11 +52,30 @@ struct TriangleDrawData {
 	TriangleInput triangleInput;
 	// Function pointer to the method that will process the command
 	DRAW_CALLBACK_TYPE processTriangle;
-	TriangleDrawData(ImageRgbaU8Impl *targetImage, ImageF32Impl *depthBuffer, bool perspective, Filter filter, const TriangleInput &triangleInput, DRAW_CALLBACK_TYPE processTriangle)
+	TriangleDrawData(ImageRgbaU8Impl *targetImage, const DepthTarget &depthBuffer, bool perspective, Filter filter, const TriangleInput &triangleInput, DRAW_CALLBACK_TYPE processTriangle)
 	: targetImage(targetImage), depthBuffer(depthBuffer), perspective(perspective), filter(filter), triangleInput(triangleInput), processTriangle(processTriangle) {}
 };
 
-struct TriangleDrawCommand : public TriangleDrawData {
+// The render state of a draw command, which is shared by consecutive triangles in a command queue, such as all triangles in the same part of a model.
+struct TriangleDrawState {
+	ImageRgbaU8Impl *targetImage;
+	DepthTarget depthBuffer;
+	bool perspective;
+	Filter filter;
+	DRAW_CALLBACK_TYPE processTriangle;
+	explicit TriangleDrawState(const TriangleDrawData &triangleDrawData)
+	: targetImage(triangleDrawData.targetImage), depthBuffer(triangleDrawData.depthBuffer), perspective(triangleDrawData.perspective),
+	  filter(triangleDrawData.filter), processTriangle(triangleDrawData.processTriangle) {}
+	bool matches(const TriangleDrawData &triangleDrawData) const {
+		return this->targetImage == triangleDrawData.targetImage && this->depthBuffer == triangleDrawData.depthBuffer && this->perspective == triangleDrawData.perspective
+		    && this->filter == triangleDrawData.filter && this->processTriangle == triangleDrawData.processTriangle;
+	}
+};
+
+// The cold part of a draw command, with the vertex data and projection that is only read when drawing the triangle.
+struct TriangleDrawCommand {
+	// Unprocessed triangle data in the standard layout
+	TriangleInput triangleInput;
 	// Triangle corners and projection
 	//   Not a part of TriangleDrawData, because the draw command is made after clipping into multiple smaller triangles
 	ITriangle2D triangle;
@@ -65,10 +89,21 @@ struct TriangleDrawCommand : public TriangleDrawData {
 	FVector3D subB, subC;
 	// Extra clipping in case that the receiver of the command goes out of bound
 	IRect clipBound;
+	TriangleDrawCommand(const TriangleDrawData &triangleDrawData, const ITriangle2D &triangle, const FVector3D &subB, const FVector3D &subC, const IRect &clipBound)
+	: triangleInput(triangleDrawData.triangleInput), triangle(triangle), subB(subB), subC(subC), clipBound(clipBound) {}
+};
+
+// The hot part of a draw command, which is all that binning, sorting and occlusion culling need to read.
+struct TriangleDrawHeader {
+	// The pixels that the triangle may touch, from the triangle's whole bound cut by the command's clip bound
+	IRect bound;
+	// The lowest and highest camera space depth among the triangle's corners
+	float nearDepth, farDepth;
+	// The index of the command's state in the command queue
+	int32_t stateIndex;
 	// Late removal of triangles without having to shuffle around any data
 	bool occluded;
-	TriangleDrawCommand(const TriangleDrawData &triangleDrawData, const ITriangle2D &triangle, const FVector3D &subB, const FVector3D &subC, const IRect &clipBound)
-	: TriangleDrawData(triangleDrawData), triangle(triangle), subB(subB), subC(subC), clipBound(clipBound), occluded(false) {}
+	TriangleDrawHeader(const TriangleDrawCommand &command, int32_t stateIndex);
 };
 
 // Get the visibility state for the triangle as seen by the camera.
@@ -78,15 +113,56 @@ struct TriangleDrawCommand : public TriangleDrawData {
 //   This is used to know when a triangle needs lossy clipping in floating-point coordinates
 //   before it can be converted to integer coordinates without causing an overflow in rasterization.
 Visibility getTriangleVisibility(const ITriangle2D &triangle, const Camera &camera, bool clipFrustum);
+// Get the same visibility state from the corner outcodes returned by camera.getOutcode.
+//   A triangle is hidden if all corners are outside of the same plane and fully visible if no corner is outside of any plane.
+inline Visibility getTriangleVisibility(uint32_t outcodeA, uint32_t outcodeB, uint32_t outcodeC, bool clipFrustum) {
+	uint32_t mask = clipFrustum ? clipOutcodeMask : cullOutcodeMask;
+	if (outcodeA & outcodeB & outcodeC & mask) {
+		return Visibility::Hidden;
+	} else if ((outcodeA | outcodeB | outcodeC) & mask) {
+		return Visibility::Partial;
+	} else {
+		return Visibility::Full;
+	}
+}
 
 // Draws according to a draw command.
-void executeTriangleDrawing(const TriangleDrawCommand &command, const IRect &clipBound);
+//   If depthHierarchy is given for the same depth buffer, it is used to skip hidden pixels and updated after drawing.
+//   If multisampled is true, the command's target images hold 2x2 samples for each pixel, as described for expandSamples.
+//   If statistics is given, the number of pixels given to the shader is added to statistics->pixelsShaded.
+void executeTriangleDrawing(const TriangleDrawState &state, const TriangleDrawCommand &command, const IRect &clipBound, DepthHierarchy *depthHierarchy = nullptr, bool multisampled = false, RenderStatistics *statistics = nullptr);
 
 // A queue of draw commands
+//   Each command is split into a header and a command at the same index, so that passes over all triangles before drawing only read the small headers.
 class CommandQueue {
 public:
-	List<TriangleDrawCommand> buffer;
-	void add(const TriangleDrawCommand &command);
+	List<TriangleDrawHeader> headers;
+	List<TriangleDrawCommand> commands;
+	// The states referred to by the headers, where consecutive commands with the same state share one element
+	List<TriangleDrawState> states;
+	// Sorting by depth lets the depth test skip more pixels and makes alpha blending independent of submission order.
+	//   Triangles with the same quantized depth keep their submitted order.
+	DrawOrder drawOrder = DrawOrder::Submitted;
+	// When enabled, the depth of all solid triangles is drawn before shading, so that pixels hidden behind later triangles are not shaded.
+	//   Solid triangles drawn with depth buffers will then shade a pixel once in most cases, except for surfaces with almost the same depth.
+	bool depthPrePass = false;
+	// When enabled, the target images hold 2x2 samples for each pixel, as described for expandSamples.
+	//   Coverage and depth are tested for each sample, but the pixel shader is called once for each pixel.
+	//   The triangles must then be projected using a camera for the resolution of the samples.
+	bool multisampled = false;
+	// When not null, triangles given to the queue and drawn by execute are counted and timed into statistics.
+	//   Must not be shared between command queues receiving triangles from different threads.
+	RenderStatistics *statistics = nullptr;
+	void add(const TriangleDrawData &triangleDrawData, const TriangleDrawCommand &command);
+	int64_t length() const { return this->headers.length(); }
+	// Moves all commands from source to the end of this queue, leaving source empty with its memory kept for reuse.
+	void append(CommandQueue &source);
+	// Draws all commands that are not occluded.
+	//   When all triangles use the same depth buffer, a depth hierarchy is created for skipping pixels hidden behind earlier triangles.
+	//   When multi-threaded, the triangles are first sorted into 64x64 pixel tiles, which are then drawn in parallel.
+	//   When drawOrder is DrawOrder::Depth, the triangles are sorted by depth within each tile.
+	//   When depthPrePass is true, each tile draws depth for all of its triangles before shading any of them.
+	//   jobCount is the maximum number of jobs used for sorting triangles into tiles.
 	// Multi-threading will be disabled if jobCount equals 1.
 	void execute(const IRect &clipBound, int jobCount = 12) const;
 	void clear();
@@ -105,17 +181,43 @@ void renderTriangleWithShader(CommandQueue *commandQueue, const TriangleDrawData
 // Triangle culling is handled automatically but you might want to apply culling per model or something before drawing many triangles.
 // commandQueue can be null to render directly using a single thread.
 // targetImage can be null to avoid using the pixel shader.
-// depthBuffer can be null to render without depth buffering.
+// depthBuffer can be empty to render without depth buffering.
 // Preconditions:
 //   * targetImage must be a render target because it needs some padding for reading out of bound while rendering.
 //     ImageRgbaU8Impl::createRenderTarget will automatically padd any odd dimensions given.
 void renderTriangleFromData(
-  CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, ImageF32Impl *depthBuffer,
+  CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, const DepthTarget &depthBuffer,
+  const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC,
+  Filter filter, const ImageRgbaU8Impl *diffuse, const ImageRgbaU8Impl *light,
+  TriangleTexCoords texCoords, TriangleColors colors
+);
+// Faster version for indexed meshes, where the corner outcodes are computed once per vertex using camera.getOutcode.
+void renderTriangleFromData(
+  CommandQueue *commandQueue, ImageRgbaU8Impl *targetImage, const DepthTarget &depthBuffer,
   const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC,
+  uint32_t outcodeA, uint32_t outcodeB, uint32_t outcodeC,
   Filter filter, const ImageRgbaU8Impl *diffuse, const ImageRgbaU8Impl *light,
   TriangleTexCoords texCoords, TriangleColors colors
 );
-void renderTriangleFromDataDepth(ImageF32Impl *depthBuffer, const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC);
+void renderTriangleFromDataDepth(const DepthTarget &depthBuffer, const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC);
+void renderTriangleFromDataDepth(
+  const DepthTarget &depthBuffer, const Camera &camera, const ProjectedPoint &posA, const ProjectedPoint &posB, const ProjectedPoint &posC,
+  uint32_t outcodeA, uint32_t outcodeB, uint32_t outcodeC
+);
+
+// Multisampled targets store 2x2 samples for each pixel in images of twice the width and height.
+//   The sample at (x * 2 + sampleX, y * 2 + sampleY) belongs to the pixel at (x, y), where sampleX and sampleY are 0 or 1.
+// Copies each pixel in colorBuffer and depthBuffer to all of its samples in sampleColorBuffer and sampleDepthBuffer.
+//   Any of the images may be null to skip that part.
+//   The depth buffers may be float or quantized images, with the same format for pixels and samples.
+void expandSamples(ImageRgbaU8Impl *sampleColorBuffer, ImageImpl *sampleDepthBuffer, const ImageRgbaU8Impl *colorBuffer, const ImageImpl *depthBuffer);
+// Writes the rounded average color of each pixel's samples to colorBuffer and the depth of each pixel's upper left sample to depthBuffer.
+//   Any of the images may be null to skip that part.
+void resolveSamples(ImageRgbaU8Impl *colorBuffer, ImageImpl *depthBuffer, const ImageRgbaU8Impl *sampleColorBuffer, const ImageImpl *sampleDepthBuffer);
+// Copies sourceDepthBuffer into depthBuffer of another resolution, taking the source pixel under each target pixel's center.
+//   Used when rendering at a scaled resolution, because interpolating depth would create depths belonging to none of the triangles along edges.
+//   Both images must have the same format, and nothing is done if any of them is null.
+void resampleDepth(ImageImpl *depthBuffer, const ImageImpl *sourceDepthBuffer);
 
 }
 
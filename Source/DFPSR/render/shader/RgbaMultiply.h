@@ -29,12 +29,13 @@
 #include <cassert>
 #include <algorithm>
 #include "Shader.h"
+#include "shaderFill.h"
 #include "../../image/ImageRgbaU8.h"
 
 namespace dsr {
 
 template <bool HAS_DIFFUSE_MAP, bool HAS_LIGHT_MAP, bool HAS_VERTEX_FADING, bool COLORLESS, bool DISABLE_MIPMAP>
-class Shader_RgbaMultiply : public Shader {
+class Shader_RgbaMultiply {
 private:
 	const TextureRgba *diffuseMap; // The full diffuseMap mipmap pyramid to use without DISABLE_MIPMAP
 	const TextureRgbaLayer *diffuseLayer; // Layer 0 of diffuseMap to use with DISABLE_MIPMAP
@@ -77,11 +78,13 @@ private:
 public:
 	// The process method to take a function pointer to.
 	//    Must have the same signature as drawCallbackTemplate in Shader.h.
-	static void processTriangle(const TriangleInput &triangleInput, ImageRgbaU8Impl *colorBuffer, ImageF32Impl *depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter) {
+	static void processTriangle(const TriangleInput &triangleInput, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter) {
 		Shader_RgbaMultiply tempShader(triangleInput);
-		tempShader.fillShape(colorBuffer, depthBuffer, triangle, projection, shape, filter);
+		// Instantiating the raster loop for this shader type lets getPixels_2x2 be inlined into it
+		shader_fillShape(tempShader, colorBuffer, depthBuffer, triangle, projection, shape, filter);
 	}
-	rgba_F32 getPixels_2x2(const F32x4x3 &vertexWeights) const override {
+	// Called by shader_fillShape for each 2x2 pixel quad
+	rgba_F32 getPixels_2x2(const F32x4x3 &vertexWeights) const {
 		if (HAS_DIFFUSE_MAP && !HAS_LIGHT_MAP && COLORLESS) {
 			// Optimized for diffuse only
 			ALIGN16 F32x4 u1(shaderMethods::interpolate(this->texCoords.u1, vertexWeights));
@@ -29,6 +29,7 @@
 #include "../../image/ImageRgbaU8.h"
 #include "../../image/ImageF32.h"
 #include "../ITriangle2D.h"
+#include "../DepthTarget.h"
 #include "shaderMethods.h"
 #include "shaderTypes.h"
 
@@ -80,13 +81,16 @@ struct TriangleInput {
 };
 
 // The template for function pointers doing the work
-inline void drawCallbackTemplate(const TriangleInput &triangleInput, ImageRgbaU8Impl *colorBuffer, ImageF32Impl *depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter) {}
+//   The depth buffer is given as a DepthTarget, which replaced the ImageF32Impl pointer used by older shaders.
+//   Custom shaders written for the old signature must change their processTriangle method to match, as described in shaderFill.h.
+inline void drawCallbackTemplate(const TriangleInput &triangleInput, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter) {}
 #define DRAW_CALLBACK_TYPE decltype(&drawCallbackTemplate)
 
-// Inherit this class for pixel shaders
+// Inherit this class for pixel shaders using a virtual call for each 2x2 pixel quad.
+//   For faster shaders, call shader_fillShape from shaderFill.h with the final shader type instead, like Shader_RgbaMultiply does.
 class Shader {
 public:
-	void fillShape(ImageRgbaU8Impl *colorBuffer, ImageF32Impl *depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter);
+	void fillShape(ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter);
 	// The main call that defines the pixel shader
 	virtual rgba_F32 getPixels_2x2(const F32x4x3 &vertexWeights) const = 0;
 };
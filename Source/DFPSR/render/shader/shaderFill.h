@@ -0,0 +1,668 @@
+﻿// zlib open source license
+//
+// Copyright (c) 2017 to 2019 David Forsgren Piuva
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+//    1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 
+//    2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 
+//    3. This notice may not be removed or altered from any source
+//    distribution.
+
+#ifndef DFPSR_RENDER_SHADER_FILL
+#define DFPSR_RENDER_SHADER_FILL
+
+#include <stdint.h>
+#include "../../image/internal/imageInternal.h"
+#include "../../image/ImageRgbaU8.h"
+#include "../../image/ImageF32.h"
+#include "../../math/scalar.h"
+#include "../ITriangle2D.h"
+#include "../DepthTarget.h"
+#include "shaderTypes.h"
+#include "../constants.h"
+
+// The raster loop for pixel shaders, defined in a header so that it can be instantiated for each shader type.
+//   A shader used with shader_fillShape is any type with a method drawing 2x2 pixels at a time from their vertex weights:
+//     rgba_F32 getPixels_2x2(const F32x4x3 &vertexWeights) const;
+//   The pixels are given in the order upper left, upper right, lower left, lower right.
+//   When SHADER is the shader's own final type, getPixels_2x2 is called directly and can be inlined into the loop.
+//   Example of a custom shader:
+//     class Shader_Custom {
+//     public:
+//       rgba_F32 getPixels_2x2(const F32x4x3 &vertexWeights) const { ... }
+//       // Can be given as the drawing callback in TriangleDrawData
+//       static void processTriangle(const TriangleInput &triangleInput, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter) {
+//         Shader_Custom shader(triangleInput);
+//         shader_fillShape(shader, colorBuffer, depthBuffer, triangle, projection, shape, filter);
+//       }
+//     };
+//   Interface change: processTriangle used to take the depth buffer as ImageF32Impl *depthBuffer.
+//     It now takes const DepthTarget &depthBuffer, so that float and 16-bit depth buffers use the same callback.
+//     Existing shaders must change the parameter type and pass it on to shader_fillShape unchanged.
+//     DepthTarget::exists() replaces checking the image pointer against nullptr.
+
+namespace dsr {
+
+// Internal helpers for shader_fillShape
+namespace shaderFill {
+
+inline uint32_t roundUpEven(uint32_t x) {
+	return (x + 1u) & ~1u;
+}
+
+inline uint32_t roundDownEven(uint32_t x) {
+	return x & ~1u;
+}
+
+template<bool CLIP_SIDES>
+inline U32x4 clippedRead(SafePointer<uint32_t> upperLeft, SafePointer<uint32_t> lowerLeft, bool vis0, bool vis1, bool vis2, bool vis3) {
+	if (CLIP_SIDES) {
+		return U32x4(vis0 ? upperLeft[0] : 0, vis1 ? upperLeft[1] : 0, vis2 ? lowerLeft[0] : 0, vis3 ? lowerLeft[1] : 0);
+	} else {
+		return U32x4(upperLeft[0], upperLeft[1], lowerLeft[0], lowerLeft[1]);
+	}
+}
+
+inline void clippedWrite(SafePointer<uint32_t> upperLeft, SafePointer<uint32_t> lowerLeft, bool vis0, bool vis1, bool vis2, bool vis3, U32x4 vColor) {
+	// Read back SIMD vector to scalar type
+	UVector4D color = vColor.get();
+	// Write colors for visible pixels
+	if (vis0) { upperLeft[0] = color.x; }
+	if (vis1) { upperLeft[1] = color.y; }
+	if (vis2) { lowerLeft[0] = color.z; }
+	if (vis3) { lowerLeft[1] = color.w; }
+}
+
+template<typename DEPTH>
+inline void clippedWriteDepth(SafePointer<DEPTH> upperLeft, SafePointer<DEPTH> lowerLeft, bool vis0, bool vis1, bool vis2, bool vis3, const DEPTH *depth) {
+	// Write depth for visible pixels
+	if (vis0) { upperLeft[0] = depth[0]; }
+	if (vis1) { upperLeft[1] = depth[1]; }
+	if (vis2) { lowerLeft[0] = depth[2]; }
+	if (vis3) { lowerLeft[1] = depth[3]; }
+}
+
+// The depth buffer stores values of type DEPTH, which is float for float depth buffers and uint16_t for quantized depth buffers.
+inline void encodeDepth(float &result, float depth, const DepthTarget &) {
+	result = depth;
+}
+inline void encodeDepth(uint16_t &result, float depth, const DepthTarget &depthBuffer) {
+	result = depthBuffer.quantize(depth);
+}
+template<typename DEPTH>
+inline void encodeDepth(DEPTH *result, const F32x4 &depth, const DepthTarget &depthBuffer) {
+	FVector4D values = depth.get();
+	encodeDepth(result[0], values.x, depthBuffer);
+	encodeDepth(result[1], values.y, depthBuffer);
+	encodeDepth(result[2], values.z, depthBuffer);
+	encodeDepth(result[3], values.w, depthBuffer);
+}
+
+// Returns true iff newDepth passes the depth test against oldDepth.
+//   In float depth buffers, a lower linear depth or a higher reciprocal depth is closer.
+//   In quantized depth buffers, a higher value is closer and equal values also pass,
+//   because a depth pre-pass written slightly further away may round to the same value.
+template<bool AFFINE>
+inline bool isInFront(float newDepth, float oldDepth) {
+	return AFFINE ? newDepth < oldDepth : newDepth > oldDepth;
+}
+template<bool AFFINE>
+inline bool isInFront(uint16_t newDepth, uint16_t oldDepth) {
+	return newDepth >= oldDepth;
+}
+
+template<bool CLIP_SIDES>
+inline void clipPixels(int x, const RowInterval &upperRow, const RowInterval &lowerRow, bool &clip0, bool &clip1, bool &clip2, bool &clip3) {
+	if (CLIP_SIDES) {
+		int x2 = x + 1;
+		clip0 = x >= upperRow.left && x < upperRow.right;
+		clip1 = x2 >= upperRow.left && x2 < upperRow.right;
+		clip2 = x >= lowerRow.left && x < lowerRow.right;
+		clip3 = x2 >= lowerRow.left && x2 < lowerRow.right;
+	} else {
+		clip0 = true;
+		clip1 = true;
+		clip2 = true;
+		clip3 = true;
+	}
+}
+
+template<bool CLIP_SIDES, bool DEPTH_READ, bool AFFINE, typename DEPTH>
+inline void getVisibility(int x, const RowInterval &upperRow, const RowInterval &lowerRow, const DEPTH *depth, const SafePointer<DEPTH> depthDataUpper, const SafePointer<DEPTH> depthDataLower, bool &vis0, bool &vis1, bool &vis2, bool &vis3) {
+	// Clip pixels
+	bool clip0, clip1, clip2, clip3;
+	clipPixels<CLIP_SIDES>(x, upperRow, lowerRow, clip0, clip1, clip2, clip3);
+	// Compare to depth buffer
+	bool front0, front1, front2, front3;
+	if (DEPTH_READ) {
+		if (CLIP_SIDES) {
+			front0 = clip0 ? isInFront<AFFINE>(depth[0], depthDataUpper[0]) : false;
+			front1 = clip1 ? isInFront<AFFINE>(depth[1], depthDataUpper[1]) : false;
+			front2 = clip2 ? isInFront<AFFINE>(depth[2], depthDataLower[0]) : false;
+			front3 = clip3 ? isInFront<AFFINE>(depth[3], depthDataLower[1]) : false;
+		} else {
+			front0 = isInFront<AFFINE>(depth[0], depthDataUpper[0]);
+			front1 = isInFront<AFFINE>(depth[1], depthDataUpper[1]);
+			front2 = isInFront<AFFINE>(depth[2], depthDataLower[0]);
+			front3 = isInFront<AFFINE>(depth[3], depthDataLower[1]);
+		}
+	} else {
+		front0 = true;
+		front1 = true;
+		front2 = true;
+		front3 = true;
+	}
+	// Decide visibility
+	vis0 = clip0 && front0;
+	vis1 = clip1 && front1;
+	vis2 = clip2 && front2;
+	vis3 = clip3 && front3;
+}
+
+template<typename SHADER, bool CLIP_SIDES, bool COLOR_WRITE, bool DEPTH_READ, bool DEPTH_WRITE, Filter FILTER, bool AFFINE, typename DEPTH>
+inline void fillQuadSuper(const SHADER& shader, int x, SafePointer<uint32_t> pixelDataUpper, SafePointer<uint32_t> pixelDataLower, SafePointer<DEPTH> depthDataUpper, SafePointer<DEPTH> depthDataLower, const RowInterval &upperRow, const RowInterval &lowerRow, const PackOrder &targetPackingOrder, const DEPTH *depth, const F32x4x3 &weights) {
+	// Get visibility
+	bool vis0, vis1, vis2, vis3;
+	getVisibility<CLIP_SIDES, DEPTH_READ, AFFINE>(x, upperRow, lowerRow, depth, depthDataUpper, depthDataLower, vis0, vis1, vis2, vis3);
+	// Draw if something is visible
+	if (vis0 || vis1 || vis2 || vis3) {
+		if (COLOR_WRITE) {
+			// Get the color
+			ALIGN16 U32x4 packedColor(0u); // Allow uninitialized memory?
+			// Execute the shader
+			ALIGN16 rgba_F32 planarSourceColor = shader.getPixels_2x2(weights);
+			// Apply alpha filtering
+			if (FILTER == Filter::Alpha) {
+				// Get opacity from the source color
+				ALIGN16 F32x4 opacity = planarSourceColor.alpha * (1.0f / 255.0f);
+				// Read the packed colors for alpha blending
+				ALIGN16 U32x4 packedTargetColor = clippedRead<CLIP_SIDES>(pixelDataUpper, pixelDataLower, vis0, vis1, vis2, vis3);
+				// Unpack the target color into planar RGBA format so that it can be mixed with the source color
+				ALIGN16 rgba_F32 planarTargetColor(packedTargetColor, targetPackingOrder);
+				// Blend linearly using floats
+				planarSourceColor = (planarSourceColor * opacity) + (planarTargetColor * (1.0f - opacity));
+			}
+			// Apply channel swapping while packing to bytes
+			packedColor = planarSourceColor.toSaturatedByte(targetPackingOrder);
+			// Write colors
+			clippedWrite(pixelDataUpper, pixelDataLower, vis0, vis1, vis2, vis3, packedColor);
+		}
+		// Write depth for visible pixels
+		if (DEPTH_WRITE) {
+			clippedWriteDepth(depthDataUpper, depthDataLower, vis0, vis1, vis2, vis3, depth);
+		}
+	}
+}
+
+// CLIP_SIDES will use upperRow and lowerRow to clip pixels based on the x value. Only x values inside the ranges can be drawn.
+//   This is used along the triangle edges.
+// COLOR_WRITE can be disabled to skip writing to the color buffer. Usually when none is given.
+// DEPTH_READ can be disabled to draw without caring if there is something already closer in the depth buffer.
+// DEPTH_WRITE can be disabled to skip writing to the depth buffer so that it does not occlude following draw calls.
+// FILTER can be set to Filter::Alpha to use the output alpha as the opacity.
+// DEPTH is the type of values in depthBuffer, which is float for float depth buffers and uint16_t for quantized depth buffers.
+template<typename SHADER, bool CLIP_SIDES, bool COLOR_WRITE, bool DEPTH_READ, bool DEPTH_WRITE, Filter FILTER, bool AFFINE, typename DEPTH>
+inline void fillRowSuper(const SHADER& shader, SafePointer<uint32_t> pixelDataUpper, SafePointer<uint32_t> pixelDataLower, SafePointer<DEPTH> depthDataUpper, SafePointer<DEPTH> depthDataLower, FVector3D pWeightUpper, FVector3D pWeightLower, const FVector3D &pWeightDx, int startX, int endX, const RowInterval &upperRow, const RowInterval &lowerRow, const PackOrder &targetPackingOrder, const DepthTarget &depthBuffer) {
+	if (AFFINE) {
+		FVector3D dx2 = pWeightDx * 2.0f;
+		ALIGN16 F32x4 vLinearDepth(pWeightUpper.x, pWeightUpper.x + pWeightDx.x, pWeightLower.x, pWeightLower.x + pWeightDx.x);
+		ALIGN16 F32x4 weightB(pWeightUpper.y, pWeightUpper.y + pWeightDx.y, pWeightLower.y, pWeightLower.y + pWeightDx.y);
+		ALIGN16 F32x4 weightC(pWeightUpper.z, pWeightUpper.z + pWeightDx.z, pWeightLower.z, pWeightLower.z + pWeightDx.z);
+		for (int x = startX; x < endX; x += 2) {
+			// Get the linear depth
+			DEPTH depth[4];
+			encodeDepth(depth, vLinearDepth, depthBuffer);
+			// Calculate the weight of the first vertex from the other two
+			ALIGN16 F32x4 weightA = 1.0f - (weightB + weightC);
+			ALIGN16 F32x4x3 weights(weightA, weightB, weightC);
+			fillQuadSuper<SHADER, CLIP_SIDES, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>(shader, x, pixelDataUpper, pixelDataLower, depthDataUpper, depthDataLower, upperRow, lowerRow, targetPackingOrder, depth, weights);
+			// Iterate projection
+			vLinearDepth = vLinearDepth + dx2.x;
+			weightB = weightB + dx2.y;
+			weightC = weightC + dx2.z;
+			// Iterate buffer pointers
+			pixelDataUpper += 2; pixelDataLower += 2;
+			depthDataUpper += 2; depthDataLower += 2;
+		}
+	} else {
+		FVector3D dx2 = pWeightDx * 2.0f;
+		ALIGN16 F32x4 vRecDepth(pWeightUpper.x, pWeightUpper.x + pWeightDx.x, pWeightLower.x, pWeightLower.x + pWeightDx.x);
+		ALIGN16 F32x4 vRecU(pWeightUpper.y, pWeightUpper.y + pWeightDx.y, pWeightLower.y, pWeightLower.y + pWeightDx.y);
+		ALIGN16 F32x4 vRecV(pWeightUpper.z, pWeightUpper.z + pWeightDx.z, pWeightLower.z, pWeightLower.z + pWeightDx.z);
+		for (int x = startX; x < endX; x += 2) {
+			// Get the reciprocal depth
+			DEPTH depth[4];
+			encodeDepth(depth, vRecDepth, depthBuffer);
+			// After linearly interpolating (1 / W, U / W, V / W) based on the affine weights...
+			// Divide 1 by 1 / W to get the linear depth W
+			ALIGN16 F32x4 vLinearDepth = vRecDepth.reciprocal();
+			// Multiply the vertex weights to the second and third edges with the depth to compensate for that we divided them by depth before interpolating.
+			ALIGN16 F32x4 weightB = vRecU * vLinearDepth;
+			ALIGN16 F32x4 weightC = vRecV * vLinearDepth;
+			// Calculate the weight of the first vertex from the other two
+			ALIGN16 F32x4 weightA = 1.0f - (weightB + weightC);
+			ALIGN16 F32x4x3 weights(weightA, weightB, weightC);
+			fillQuadSuper<SHADER, CLIP_SIDES, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>(shader, x, pixelDataUpper, pixelDataLower, depthDataUpper, depthDataLower, upperRow, lowerRow, targetPackingOrder, depth, weights);
+			// Iterate projection
+			vRecDepth = vRecDepth + dx2.x;
+			vRecU = vRecU + dx2.y;
+			vRecV = vRecV + dx2.z;
+			// Iterate buffer pointers
+			pixelDataUpper += 2; pixelDataLower += 2;
+			depthDataUpper += 2; depthDataLower += 2;
+		}
+	}
+}
+
+template<typename SHADER, bool COLOR_WRITE, bool DEPTH_READ, bool DEPTH_WRITE, Filter FILTER, bool AFFINE, typename DEPTH>
+inline void fillShapeSuper(const SHADER& shader, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &, const Projection &projection, const RowShape &shape) {
+	// Prepare constants
+	const int targetStride = imageInternal::getStride(colorBuffer);
+	const int depthBufferStride = imageInternal::getStride(depthBuffer.image);
+	const FVector3D doublePWeightDx = projection.pWeightDx * 2.0f;
+	const int colorRowSize = imageInternal::getRowSize(colorBuffer);
+	const int depthRowSize = imageInternal::getRowSize(depthBuffer.image);
+	const PackOrder& targetPackingOrder = imageInternal::getPackOrder(colorBuffer);
+	const int colorHeight = imageInternal::getHeight(colorBuffer);
+	const int depthHeight = imageInternal::getHeight(depthBuffer.image);
+	const int maxHeight = colorHeight > depthHeight ? colorHeight : depthHeight;
+
+	// Initialize row pointers for color buffer
+	SafePointer<uint32_t> pixelDataUpper, pixelDataLower, pixelDataUpperRow, pixelDataLowerRow;
+	if (COLOR_WRITE) {
+		SafePointer<uint32_t> targetData = imageInternal::getSafeData<uint32_t>(colorBuffer);
+		pixelDataUpperRow = targetData;
+		pixelDataUpperRow.increaseBytes(shape.startRow * targetStride);
+		pixelDataLowerRow = targetData;
+		pixelDataLowerRow.increaseBytes((shape.startRow + 1) * targetStride);
+	} else {
+		pixelDataUpperRow = SafePointer<uint32_t>();
+		pixelDataLowerRow = SafePointer<uint32_t>();
+	}
+
+	// Initialize row pointers for depth buffer
+	SafePointer<DEPTH> depthDataUpper, depthDataLower, depthDataUpperRow, depthDataLowerRow;
+	if (DEPTH_READ || DEPTH_WRITE) {
+		SafePointer<DEPTH> depthBufferData = imageInternal::getSafeData<DEPTH>(depthBuffer.image);
+		depthDataUpperRow = depthBufferData;
+		depthDataUpperRow.increaseBytes(shape.startRow * depthBufferStride);
+		depthDataLowerRow = depthBufferData;
+		depthDataLowerRow.increaseBytes((shape.startRow + 1) * depthBufferStride);
+	} else {
+		depthDataUpperRow = SafePointer<DEPTH>();
+		depthDataLowerRow = SafePointer<DEPTH>();
+	}
+	for (int32_t y1 = shape.startRow; y1 < shape.startRow + shape.rowCount; y1 += 2) {
+		int y2 = y1 + 1;
+		RowInterval upperRow = shape.rows[y1 - shape.startRow];
+		RowInterval lowerRow = shape.rows[y2 - shape.startRow];
+		int outerStart = min(upperRow.left, lowerRow.left);
+		int outerEnd = max(upperRow.right, lowerRow.right);
+		int innerStart = max(upperRow.left, lowerRow.left);
+		int innerEnd = min(upperRow.right, lowerRow.right);
+		// Round exclusive intervals to multiples of two pixels
+		int outerBlockStart = roundDownEven(outerStart);
+		int outerBlockEnd = roundUpEven(outerEnd);
+		int innerBlockStart = roundUpEven(innerStart);
+		int innerBlockEnd = roundDownEven(innerEnd);
+		// Clip last row if outside on odd height
+		if (y2 >= maxHeight) {
+			lowerRow.right = lowerRow.left;
+		}
+		// Avoid reading outside of the given bound
+		bool hasTop = upperRow.right > upperRow.left;
+		bool hasBottom = lowerRow.right > lowerRow.left;
+		if (hasTop || hasBottom) {
+			// Initialize pointers
+			if (COLOR_WRITE) {
+				if (hasTop) {
+					pixelDataUpper = pixelDataUpperRow.slice("pixelDataUpper", 0, colorRowSize);
+				} else {
+					// Repeat the lower row to avoid reading outside
+					pixelDataUpper = pixelDataLowerRow.slice("pixelDataUpper (from lower)", 0, colorRowSize);
+				}
+				if (hasBottom) {
+					pixelDataLower = pixelDataLowerRow.slice("pixelDataLower", 0, colorRowSize);
+				} else {
+					// Repeat the upper row to avoid reading outside
+					pixelDataLower = pixelDataUpperRow.slice("pixelDataLower (from upper)", 0, colorRowSize);
+				}
+				int startColorOffset = outerBlockStart * sizeof(uint32_t);
+				pixelDataUpper.increaseBytes(startColorOffset);
+				pixelDataLower.increaseBytes(startColorOffset);
+			}
+			if (DEPTH_READ || DEPTH_WRITE) {
+				if (hasTop) {
+					depthDataUpper = depthDataUpperRow.slice("depthDataUpper", 0, depthRowSize);
+				} else {
+					// Repeat the upper row to avoid reading outside
+					depthDataUpper = depthDataLowerRow.slice("depthDataUpper (from lower)", 0, depthRowSize);
+				}
+				if (hasBottom) {
+					depthDataLower = depthDataLowerRow.slice("depthDataLower", 0, depthRowSize);
+				} else {
+					// Repeat the upper row to avoid reading outside
+					depthDataLower = depthDataUpperRow.slice("depthDataLower (from upper)", 0, depthRowSize);
+				}
+				depthDataUpper += outerBlockStart;
+				depthDataLower += outerBlockStart;
+			} else {
+				depthDataUpper = SafePointer<DEPTH>();
+				depthDataLower = SafePointer<DEPTH>();
+			}
+			// Initialize projection
+			FVector3D pWeightUpperRow;
+			if (AFFINE) {
+				pWeightUpperRow = projection.getWeight_affine(IVector2D(outerBlockStart, y1));
+			} else {
+				pWeightUpperRow = projection.getDepthDividedWeight_perspective(IVector2D(outerBlockStart, y1));
+			}
+			FVector3D pWeightUpper = pWeightUpperRow;
+			FVector3D pWeightLowerRow = pWeightUpperRow + projection.pWeightDy;
+			FVector3D pWeightLower = pWeightLowerRow;
+			// Render the pixels
+			if (innerBlockEnd <= innerBlockStart) {
+				// Clipped from left and right
+				for (int32_t x = outerBlockStart; x < outerBlockEnd; x += 2) {
+					fillRowSuper<SHADER, true, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>
+					  (shader, pixelDataUpper, pixelDataLower, depthDataUpper, depthDataLower, pWeightUpper, pWeightLower, projection.pWeightDx, x, x + 2, upperRow, lowerRow, targetPackingOrder, depthBuffer);
+					if (COLOR_WRITE) { pixelDataUpper += 2; pixelDataLower += 2; }
+					if (DEPTH_READ || DEPTH_WRITE) { depthDataUpper += 2; depthDataLower += 2; }
+					pWeightUpper = pWeightUpper + doublePWeightDx; pWeightLower = pWeightLower + doublePWeightDx;
+				}
+			} else {
+				// Left edge
+				for (int32_t x = outerBlockStart; x < innerBlockStart; x += 2) {
+					fillRowSuper<SHADER, true, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>
+					  (shader, pixelDataUpper, pixelDataLower, depthDataUpper, depthDataLower, pWeightUpper, pWeightLower, projection.pWeightDx, x, x + 2, upperRow, lowerRow, targetPackingOrder, depthBuffer);
+					if (COLOR_WRITE) { pixelDataUpper += 2; pixelDataLower += 2; }
+					if (DEPTH_READ || DEPTH_WRITE) { depthDataUpper += 2; depthDataLower += 2; }
+					pWeightUpper = pWeightUpper + doublePWeightDx; pWeightLower = pWeightLower + doublePWeightDx;
+				}
+				// Full quads
+				int width = innerBlockEnd - innerBlockStart;
+				int quadCount = width / 2;
+				fillRowSuper<SHADER, false, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>
+				  (shader, pixelDataUpper, pixelDataLower, depthDataUpper, depthDataLower, pWeightUpper, pWeightLower, projection.pWeightDx, innerBlockStart, innerBlockEnd, RowInterval(), RowInterval(), targetPackingOrder, depthBuffer);
+				if (COLOR_WRITE) { pixelDataUpper += 2 * quadCount; pixelDataLower += 2 * quadCount; }
+				if (DEPTH_READ || DEPTH_WRITE) { depthDataUpper += 2 * quadCount; depthDataLower += 2 * quadCount; }
+				pWeightUpper = pWeightUpper + (doublePWeightDx * quadCount); pWeightLower = pWeightLower + (doublePWeightDx * quadCount);
+				// Right edge
+				for (int32_t x = innerBlockEnd; x < outerBlockEnd; x += 2) {
+					fillRowSuper<SHADER, true, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>
+					  (shader, pixelDataUpper, pixelDataLower, depthDataUpper, depthDataLower, pWeightUpper, pWeightLower, projection.pWeightDx, x, x + 2, upperRow, lowerRow, targetPackingOrder, depthBuffer);
+					if (COLOR_WRITE) { pixelDataUpper += 2; pixelDataLower += 2; }
+					if (DEPTH_READ || DEPTH_WRITE) { depthDataUpper += 2; depthDataLower += 2; }
+					pWeightUpper = pWeightUpper + doublePWeightDx; pWeightLower = pWeightLower + doublePWeightDx;
+				}
+			}
+		}
+		// Iterate to the next row
+		if (COLOR_WRITE) {
+			pixelDataUpperRow.increaseBytes(targetStride * 2);
+			pixelDataLowerRow.increaseBytes(targetStride * 2);
+		}
+		if (DEPTH_READ || DEPTH_WRITE) {
+			depthDataUpperRow.increaseBytes(depthBufferStride * 2);
+			depthDataLowerRow.increaseBytes(depthBufferStride * 2);
+		}
+	}
+}
+
+// Draws a block of 4x4 samples in a multisampled target, covering 2x2 pixels that are shaded once each.
+//   rows are the row intervals for the four sample rows starting at blockY, where empty rows have no pointers.
+//   pWeight is the projection at the center of the block's upper left sample.
+template<typename SHADER, bool COLOR_WRITE, bool DEPTH_READ, bool DEPTH_WRITE, Filter FILTER, bool AFFINE, typename DEPTH>
+inline void fillBlockMultisampled(const SHADER& shader, int blockX, SafePointer<uint32_t> *pixelRows, SafePointer<DEPTH> *depthRows, const RowInterval *rows, const PackOrder &targetPackingOrder, const FVector3D &pWeight, const Projection &projection, const DepthTarget &depthBuffer) {
+	// Find the visible samples, using bit (sampleX + sampleY * 4) for each sample in the block
+	DEPTH sampleDepth[16];
+	uint32_t visibleSamples = 0u;
+	for (int sampleY = 0; sampleY < 4; sampleY++) {
+		const RowInterval &row = rows[sampleY];
+		float rowDepth = pWeight.x + projection.pWeightDy.x * sampleY;
+		for (int sampleX = 0; sampleX < 4; sampleX++) {
+			int x = blockX + sampleX;
+			if (x >= row.left && x < row.right) {
+				int index = sampleX + sampleY * 4;
+				DEPTH depth;
+				encodeDepth(depth, rowDepth + projection.pWeightDx.x * sampleX, depthBuffer);
+				bool front = true;
+				if (DEPTH_READ) {
+					front = isInFront<AFFINE>(depth, depthRows[sampleY][x]);
+				}
+				if (front) {
+					sampleDepth[index] = depth;
+					visibleSamples |= 1u << index;
+				}
+			}
+		}
+	}
+	// Draw if something is visible
+	if (visibleSamples) {
+		if (COLOR_WRITE) {
+			// Get the projection at the center of each pixel, which is between its four samples
+			FVector3D upperLeft = pWeight + (projection.pWeightDx + projection.pWeightDy) * 0.5f;
+			FVector3D upperRight = upperLeft + projection.pWeightDx * 2.0f;
+			FVector3D lowerLeft = upperLeft + projection.pWeightDy * 2.0f;
+			FVector3D lowerRight = lowerLeft + projection.pWeightDx * 2.0f;
+			ALIGN16 F32x4 weightB(upperLeft.y, upperRight.y, lowerLeft.y, lowerRight.y);
+			ALIGN16 F32x4 weightC(upperLeft.z, upperRight.z, lowerLeft.z, lowerRight.z);
+			if (!AFFINE) {
+				// Divide the interpolated (U / W, V / W) by the interpolated 1 / W, like fillRowSuper
+				ALIGN16 F32x4 vLinearDepth = F32x4(upperLeft.x, upperRight.x, lowerLeft.x, lowerRight.x).reciprocal();
+				weightB = weightB * vLinearDepth;
+				weightC = weightC * vLinearDepth;
+			}
+			ALIGN16 F32x4 weightA = 1.0f - (weightB + weightC);
+			ALIGN16 F32x4x3 weights(weightA, weightB, weightC);
+			// Execute the shader once for each pixel
+			ALIGN16 rgba_F32 planarSourceColor = shader.getPixels_2x2(weights);
+			if (FILTER == Filter::Alpha) {
+				// Each sample has its own target color to blend with, so blend one sample location at a time for all four pixels
+				ALIGN16 F32x4 opacity = planarSourceColor.alpha * (1.0f / 255.0f);
+				ALIGN16 rgba_F32 weightedSourceColor = planarSourceColor * opacity;
+				ALIGN16 F32x4 targetOpacity = 1.0f - opacity;
+				for (int location = 0; location < 4; location++) {
+					int sampleIndex[4];
+					bool visible[4];
+					uint32_t targetColor[4];
+					for (int pixel = 0; pixel < 4; pixel++) {
+						int sampleX = (pixel & 1) * 2 + (location & 1);
+						int sampleY = (pixel >> 1) * 2 + (location >> 1);
+						sampleIndex[pixel] = sampleX + sampleY * 4;
+						visible[pixel] = (visibleSamples >> sampleIndex[pixel]) & 1u;
+						targetColor[pixel] = visible[pixel] ? pixelRows[sampleY][blockX + sampleX] : 0u;
+					}
+					ALIGN16 rgba_F32 planarTargetColor(U32x4(targetColor[0], targetColor[1], targetColor[2], targetColor[3]), targetPackingOrder);
+					UVector4D color = (weightedSourceColor + (planarTargetColor * targetOpacity)).toSaturatedByte(targetPackingOrder).get();
+					uint32_t pixelColor[4] = {color.x, color.y, color.z, color.w};
+					for (int pixel = 0; pixel < 4; pixel++) {
+						if (visible[pixel]) {
+							int sampleX = sampleIndex[pixel] & 3;
+							int sampleY = sampleIndex[pixel] >> 2;
+							pixelRows[sampleY][blockX + sampleX] = pixelColor[pixel];
+						}
+					}
+				}
+			} else {
+				// Write each pixel's color to its visible samples
+				UVector4D color = planarSourceColor.toSaturatedByte(targetPackingOrder).get();
+				uint32_t pixelColor[4] = {color.x, color.y, color.z, color.w};
+				for (int index = 0; index < 16; index++) {
+					if ((visibleSamples >> index) & 1u) {
+						int sampleX = index & 3;
+						int sampleY = index >> 2;
+						pixelRows[sampleY][blockX + sampleX] = pixelColor[(sampleX >> 1) + (sampleY >> 1) * 2];
+					}
+				}
+			}
+		}
+		// Write depth for visible samples
+		if (DEPTH_WRITE) {
+			for (int index = 0; index < 16; index++) {
+				if ((visibleSamples >> index) & 1u) {
+					depthRows[index >> 2][blockX + (index & 3)] = sampleDepth[index];
+				}
+			}
+		}
+	}
+}
+
+// Fills a shape given in samples for a multisampled target, where each pixel has 2x2 samples.
+//   Coverage and depth are tested for each sample, while the shader is called once for each 2x2 pixels.
+template<typename SHADER, bool COLOR_WRITE, bool DEPTH_READ, bool DEPTH_WRITE, Filter FILTER, bool AFFINE, typename DEPTH>
+inline void fillShapeMultisampled(const SHADER& shader, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const Projection &projection, const RowShape &shape) {
+	// Prepare constants
+	const int colorRowSize = imageInternal::getRowSize(colorBuffer);
+	const int depthRowSize = imageInternal::getRowSize(depthBuffer.image);
+	const PackOrder& targetPackingOrder = imageInternal::getPackOrder(colorBuffer);
+	const int colorHeight = imageInternal::getHeight(colorBuffer);
+	const int depthHeight = imageInternal::getHeight(depthBuffer.image);
+	const int maxHeight = colorHeight > depthHeight ? colorHeight : depthHeight;
+	const FVector3D quadruplePWeightDx = projection.pWeightDx * 4.0f;
+	const int endRow = min(shape.startRow + shape.rowCount, maxHeight);
+	// Blocks of 4x4 samples are aligned with 2x2 pixels
+	for (int32_t blockY = shape.startRow & ~3; blockY < endRow; blockY += 4) {
+		RowInterval rows[4];
+		SafePointer<uint32_t> pixelRows[4];
+		SafePointer<DEPTH> depthRows[4];
+		int outerStart = 0;
+		int outerEnd = 0;
+		for (int sampleY = 0; sampleY < 4; sampleY++) {
+			int y = blockY + sampleY;
+			if (y >= shape.startRow && y < endRow) {
+				RowInterval row = shape.rows[y - shape.startRow];
+				// Only get pointers to rows with samples to draw, so that nothing outside of the image is accessed
+				if (row.right > row.left) {
+					rows[sampleY] = row;
+					if (outerEnd <= outerStart) {
+						outerStart = row.left;
+						outerEnd = row.right;
+					} else {
+						outerStart = min(outerStart, row.left);
+						outerEnd = max(outerEnd, row.right);
+					}
+					if (COLOR_WRITE) {
+						pixelRows[sampleY] = imageInternal::getSafeData<uint32_t>(colorBuffer, y).slice("pixelRows", 0, colorRowSize);
+					}
+					if (DEPTH_READ || DEPTH_WRITE) {
+						depthRows[sampleY] = imageInternal::getSafeData<DEPTH>(depthBuffer.image, y).slice("depthRows", 0, depthRowSize);
+					}
+				}
+			}
+		}
+		if (outerEnd > outerStart) {
+			int blockStart = outerStart & ~3;
+			FVector3D pWeight;
+			if (AFFINE) {
+				pWeight = projection.getWeight_affine(IVector2D(blockStart, blockY));
+			} else {
+				pWeight = projection.getDepthDividedWeight_perspective(IVector2D(blockStart, blockY));
+			}
+			for (int32_t blockX = blockStart; blockX < outerEnd; blockX += 4) {
+				fillBlockMultisampled<SHADER, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>(shader, blockX, pixelRows, depthRows, rows, targetPackingOrder, pWeight, projection, depthBuffer);
+				pWeight = pWeight + quadruplePWeightDx;
+			}
+		}
+	}
+}
+
+// Fills the shape using the raster loop for the shape's kind of target.
+template<typename SHADER, bool COLOR_WRITE, bool DEPTH_READ, bool DEPTH_WRITE, Filter FILTER, bool AFFINE, typename DEPTH>
+inline void fillShape(const SHADER& shader, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape) {
+	if (shape.multisampled) {
+		fillShapeMultisampled<SHADER, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>(shader, colorBuffer, depthBuffer, projection, shape);
+	} else {
+		fillShapeSuper<SHADER, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, DEPTH>(shader, colorBuffer, depthBuffer, triangle, projection, shape);
+	}
+}
+
+// Fills the shape using the depth buffer's format.
+template<typename SHADER, bool COLOR_WRITE, bool DEPTH_READ, bool DEPTH_WRITE, Filter FILTER, bool AFFINE>
+inline void fillShapeWithDepth(const SHADER& shader, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape) {
+	if (depthBuffer.quantized) {
+		fillShape<SHADER, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, uint16_t>(shader, colorBuffer, depthBuffer, triangle, projection, shape);
+	} else {
+		fillShape<SHADER, COLOR_WRITE, DEPTH_READ, DEPTH_WRITE, FILTER, AFFINE, float>(shader, colorBuffer, depthBuffer, triangle, projection, shape);
+	}
+}
+
+}
+
+// Fills the shape of a triangle using shader.
+template<typename SHADER>
+inline void shader_fillShape(const SHADER &shader, ImageRgbaU8Impl *colorBuffer, const DepthTarget &depthBuffer, const ITriangle2D &triangle, const Projection &projection, const RowShape &shape, Filter filter) {
+	bool hasColorBuffer = colorBuffer != nullptr;
+	bool hasDepthBuffer = depthBuffer.exists();
+	if (projection.affine) {
+		if (hasDepthBuffer) {
+			if (hasColorBuffer) {
+				if (filter != Filter::Solid) {
+					// Alpha filtering with read only depth buffer
+					shaderFill::fillShapeWithDepth<SHADER, true, true, false, Filter::Alpha, true>(shader, colorBuffer, depthBuffer, triangle, projection, shape);
+				} else {
+					// Solid with depth buffer
+					shaderFill::fillShapeWithDepth<SHADER, true, true, true, Filter::Solid, true>(shader, colorBuffer, depthBuffer, triangle, projection, shape);
+				}
+			} else {
+				// Solid depth
+				// TODO: Use for orthogonal depth based shadows
+				shaderFill::fillShapeWithDepth<SHADER, false, true, true, Filter::Solid, true>(shader, nullptr, depthBuffer, triangle, projection, shape);
+			}
+		} else {
+			if (hasColorBuffer) {
+				if (filter != Filter::Solid) {
+					// Alpha filtering without depth buffer
+					shaderFill::fillShape<SHADER, true, false, false, Filter::Alpha, true, float>(shader, colorBuffer, DepthTarget(), triangle, projection, shape);
+				} else {
+					// Solid without depth buffer
+					shaderFill::fillShape<SHADER, true, false, false, Filter::Solid, true, float>(shader, colorBuffer, DepthTarget(), triangle, projection, shape);
+				}
+			}
+		}
+	} else {
+		if (hasDepthBuffer) {
+			if (hasColorBuffer) {
+				if (filter != Filter::Solid) {
+					// Alpha filtering with read only depth buffer
+					shaderFill::fillShapeWithDepth<SHADER, true, true, false, Filter::Alpha, false>(shader, colorBuffer, depthBuffer, triangle, projection, shape);
+				} else {
+					// Solid with depth buffer
+					shaderFill::fillShapeWithDepth<SHADER, true, true, true, Filter::Solid, false>(shader, colorBuffer, depthBuffer, triangle, projection, shape);
+				}
+			} else {
+				// Solid depth
+				// TODO: Use for depth based shadows with perspective projection
+				shaderFill::fillShapeWithDepth<SHADER, false, true, true, Filter::Solid, false>(shader, nullptr, depthBuffer, triangle, projection, shape);
+			}
+		} else {
+			if (hasColorBuffer) {
+				if (filter != Filter::Solid) {
+					// Alpha filtering without depth buffer
+					shaderFill::fillShape<SHADER, true, false, false, Filter::Alpha, false, float>(shader, colorBuffer, DepthTarget(), triangle, projection, shape);
+				} else {
+					// Solid without depth buffer
+					shaderFill::fillShape<SHADER, true, false, false, Filter::Solid, false, float>(shader, colorBuffer, DepthTarget(), triangle, projection, shape);
+				}
+			}
+		}
+	}
+}
+
+}
+
+#endif
+
@@ -164,7 +164,8 @@ static void addPointLightSuper(const OrthoView& camera, const IVector2D& worldCe
 		float colorG = std::max(0.0f, (float)lightColor.green * lightIntensity);
 		float colorB = std::max(0.0f, (float)lightColor.blue * lightIntensity);
 		float reciprocalRadius = 1.0f / lightRadius;
-		threadedSplit(rectangleBound, [
+		// Shadows and the light radius make some rows much heavier than others, so let idle threads steal rows
+		threadedSplit_adaptive(rectangleBound, [
 		  lightBuffer, normalBuffer, heightBuffer, camera, worldCenter, inYourFaceAxis, lightSpaceSourcePosition,
 		  reciprocalRadius, colorR, colorG, colorB, shadowCubeMap](const IRect& bound) mutable {
 			// Initiate the local light-space sweep along base height
@@ -249,7 +250,7 @@ static void addPointLightSuper(const OrthoView& camera, const IVector2D& worldCe
 				normalRow.increaseBytes(normalStride);
 				heightRow.increaseBytes(heightStride);
 			}
-		});
+		}, 8);
 	}
 }
 
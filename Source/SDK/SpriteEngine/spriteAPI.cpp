@@ -7,6 +7,7 @@
 #include "../../DFPSR/base/endian.h"
 #include "../../DFPSR/math/scalar.h"
 #include "../../DFPSR/api/fileAPI.h"
+#include "../../DFPSR/base/threading.h"
 
 // Comment out a flag to disable an optimization when debugging
 #define DIRTY_RECTANGLE_OPTIMIZATION
@@ -372,48 +373,45 @@ public:
 	PointLight(FVector3D position, float radius, float intensity, ColorRgbI32 color, bool shadowCasting)
 	: position(position), radius(radius), intensity(intensity), color(color), shadowCasting(shadowCasting) {}
 public:
-	void renderModelShadow(CubeMapF32& shadowTarget, const ModelInstance& modelInstance, const FMatrix3x3& normalToWorld) const {
+	// Each side of the cube map is rendered separately, so that the six sides can be rendered in parallel
+	void renderModelShadow(CubeMapF32& shadowTarget, int side, const ModelInstance& modelInstance, const FMatrix3x3& normalToWorld) const {
 		Model model = modelTypes[modelInstance.typeIndex].shadowModel;
 		if (model_exists(model)) {
 			// Place the model relative to the light source's position, to make rendering in light-space easier
 			Transform3D modelToWorldTransform = modelInstance.location;
 			modelToWorldTransform.position = modelToWorldTransform.position - this->position;
-			for (int s = 0; s < 6; s++) {
-				Camera camera = Camera::createPerspective(Transform3D(FVector3D(), ShadowCubeMapSides[s] * normalToWorld), shadowTarget.resolution, shadowTarget.resolution);
-				model_renderDepth(model, modelToWorldTransform, shadowTarget.cubeMapViews[s], camera);
-			}
+			Camera camera = Camera::createPerspective(Transform3D(FVector3D(), ShadowCubeMapSides[side] * normalToWorld), shadowTarget.resolution, shadowTarget.resolution);
+			model_renderDepth(model, modelToWorldTransform, shadowTarget.cubeMapViews[side], camera);
 		}
 	}
-	void renderSpriteShadow(CubeMapF32& shadowTarget, const SpriteInstance& spriteInstance, const FMatrix3x3& normalToWorld) const {
+	void renderSpriteShadow(CubeMapF32& shadowTarget, int side, const SpriteInstance& spriteInstance, const FMatrix3x3& normalToWorld) const {
 		if (spriteInstance.shadowCasting) {
 			Model model = spriteTypes[spriteInstance.typeIndex].shadowModel;
 			if (model_exists(model)) {
 				// Place the model relative to the light source's position, to make rendering in light-space easier
 				Transform3D modelToWorldTransform = Transform3D(ortho_miniToFloatingTile(spriteInstance.location) - this->position, spriteDirections[spriteInstance.direction]);
-				for (int s = 0; s < 6; s++) {
-					Camera camera = Camera::createPerspective(Transform3D(FVector3D(), ShadowCubeMapSides[s] * normalToWorld), shadowTarget.resolution, shadowTarget.resolution);
-					model_renderDepth(model, modelToWorldTransform, shadowTarget.cubeMapViews[s], camera);
-				}
+				Camera camera = Camera::createPerspective(Transform3D(FVector3D(), ShadowCubeMapSides[side] * normalToWorld), shadowTarget.resolution, shadowTarget.resolution);
+				model_renderDepth(model, modelToWorldTransform, shadowTarget.cubeMapViews[side], camera);
 			}
 		}
 	}
 	// Render shadows from passive sprites
-	void renderPassiveShadows(CubeMapF32& shadowTarget, Octree<SpriteInstance>& sprites, const FMatrix3x3& normalToWorld) const {
+	void renderPassiveShadows(CubeMapF32& shadowTarget, int side, Octree<SpriteInstance>& sprites, const FMatrix3x3& normalToWorld) const {
 		IVector3D center = ortho_floatingTileToMini(this->position);
 		IVector3D minBound = center - ortho_floatingTileToMini(radius);
 		IVector3D maxBound = center + ortho_floatingTileToMini(radius);
-		sprites.map(minBound, maxBound, [this, shadowTarget, normalToWorld](SpriteInstance& sprite, const IVector3D origin, const IVector3D minBound, const IVector3D maxBound) mutable {
-			this->renderSpriteShadow(shadowTarget, sprite, normalToWorld);
+		sprites.map(minBound, maxBound, [this, shadowTarget, side, normalToWorld](SpriteInstance& sprite, const IVector3D origin, const IVector3D minBound, const IVector3D maxBound) mutable {
+			this->renderSpriteShadow(shadowTarget, side, sprite, normalToWorld);
 			return LeafAction::None;
 		});
 	}
 	// Render shadows from passive models
-	void renderPassiveShadows(CubeMapF32& shadowTarget, Octree<ModelInstance>& models, const FMatrix3x3& normalToWorld) const {
+	void renderPassiveShadows(CubeMapF32& shadowTarget, int side, Octree<ModelInstance>& models, const FMatrix3x3& normalToWorld) const {
 		IVector3D center = ortho_floatingTileToMini(this->position);
 		IVector3D minBound = center - ortho_floatingTileToMini(radius);
 		IVector3D maxBound = center + ortho_floatingTileToMini(radius);
-		models.map(minBound, maxBound, [this, shadowTarget, normalToWorld](ModelInstance& model, const IVector3D origin, const IVector3D minBound, const IVector3D maxBound) mutable {
-			this->renderModelShadow(shadowTarget, model, normalToWorld);
+		models.map(minBound, maxBound, [this, shadowTarget, side, normalToWorld](ModelInstance& model, const IVector3D origin, const IVector3D minBound, const IVector3D maxBound) mutable {
+			this->renderModelShadow(shadowTarget, side, model, normalToWorld);
 			return LeafAction::None;
 		});
 	}
@@ -599,10 +597,12 @@ public:
 private:
 	// Reused buffers
 	int shadowResolution;
-	CubeMapF32 temporaryShadowMap;
+	// Two shadow maps allow casting shadows from the next point light while the previous light is being applied
+	CubeMapF32 temporaryShadowMaps[2];
 public:
 	SpriteWorldImpl(const OrthoSystem &ortho, int shadowResolution)
-	: ortho(ortho), passiveSprites(ortho_miniUnitsPerTile * 64), passiveModels(ortho_miniUnitsPerTile * 64), shadowResolution(shadowResolution), temporaryShadowMap(shadowResolution) {}
+	: ortho(ortho), passiveSprites(ortho_miniUnitsPerTile * 64), passiveModels(ortho_miniUnitsPerTile * 64), shadowResolution(shadowResolution),
+	  temporaryShadowMaps{CubeMapF32(shadowResolution), CubeMapF32(shadowResolution)} {}
 public:
 	// Post-condition: Returns the number of redrawn background blocks. (0 or 1)
 	int updateBlockAt(const IRect& blockRegion, const IRect& seenRegion) {
@@ -750,8 +750,6 @@ public:
 		return IVector2D(image_getWidth(colorTarget) / 2, image_getHeight(colorTarget) / 2) - this->ortho.miniTileOffsetToScreenPixel(this->cameraLocation, this->cameraIndex);
 	}
 	void draw(AlignedImageRgbaU8& colorTarget) {
-		double startTime;
-
 		IVector2D worldCenter = this->findWorldCenter(colorTarget);
 
 		// Resize when the window has resized or the buffers haven't been allocated before
@@ -764,53 +762,87 @@ public:
 			this->heightBuffer = image_create_F32(width, height);
 		}
 
+		// Each stage declares which buffers it reads and writes, so that independent stages can run at the same time.
+		//   Shadows only read the scene, so they can be cast while drawing deferred images and applying earlier lights.
+		TaskResource diffuseResource = TaskResource(&this->diffuseBuffer);
+		TaskResource normalResource = TaskResource(&this->normalBuffer);
+		TaskResource heightResource = TaskResource(&this->heightBuffer);
+		TaskResource lightResource = TaskResource(&this->lightBuffer);
+		TaskGraph graph;
+
 		IRect worldRegion = IRect(-worldCenter.x, -worldCenter.y, width, height);
-		startTime = time_getSeconds();
-			this->drawDeferred(this->diffuseBuffer, this->normalBuffer, this->heightBuffer, worldRegion);
-		debugText("Draw deferred: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+		graph.addTask([this, worldRegion]() {
+			double startTime = time_getSeconds();
+				this->drawDeferred(this->diffuseBuffer, this->normalBuffer, this->heightBuffer, worldRegion);
+			debugText("Draw deferred: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+		}, {}, {diffuseResource, normalResource, heightResource});
 
 		// Illuminate using directed lights
 		if (this->temporaryDirectedLights.length() > 0) {
-			startTime = time_getSeconds();
-				// Overwriting any light from the previous frame
-				for (int p = 0; p < this->temporaryDirectedLights.length(); p++) {
-					this->temporaryDirectedLights[p].illuminate(this->ortho.view[this->cameraIndex], worldCenter, this->lightBuffer, this->normalBuffer, p == 0);
-				}
-			debugText("Sun light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+			graph.addTask([this, worldCenter]() {
+				double startTime = time_getSeconds();
+					// Overwriting any light from the previous frame
+					for (int p = 0; p < this->temporaryDirectedLights.length(); p++) {
+						this->temporaryDirectedLights[p].illuminate(this->ortho.view[this->cameraIndex], worldCenter, this->lightBuffer, this->normalBuffer, p == 0);
+					}
+				debugText("Sun light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+			}, {normalResource}, {lightResource});
 		} else {
-			startTime = time_getSeconds();
-				image_fill(this->lightBuffer, ColorRgbaI32(0)); // Set light to black
-			debugText("Clear light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+			graph.addTask([this]() {
+				double startTime = time_getSeconds();
+					image_fill(this->lightBuffer, ColorRgbaI32(0)); // Set light to black
+				debugText("Clear light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+			}, {}, {lightResource});
 		}
 
 		// Illuminate using point lights
+		int shadowCount = 0;
 		for (int p = 0; p < this->temporaryPointLights.length(); p++) {
 			PointLight *currentLight = &this->temporaryPointLights[p];
+			CubeMapF32 *shadowMap = &this->temporaryShadowMaps[shadowCount % 2];
+			TaskResource shadowResource = TaskResource(shadowMap);
 			if (currentLight->shadowCasting) {
-				startTime = time_getSeconds();
-				this->temporaryShadowMap.clear();
-				// Shadows from background sprites
-				currentLight->renderPassiveShadows(this->temporaryShadowMap, this->passiveSprites, ortho.view[this->cameraIndex].normalToWorldSpace);
-				currentLight->renderPassiveShadows(this->temporaryShadowMap, this->passiveModels, ortho.view[this->cameraIndex].normalToWorldSpace);
-				// Shadows from temporary sprites
-				for (int s = 0; s < this->temporarySprites.length(); s++) {
-					currentLight->renderSpriteShadow(this->temporaryShadowMap, this->temporarySprites[s], ortho.view[this->cameraIndex].normalToWorldSpace);
-				}
-				// Shadows from temporary models
-				for (int s = 0; s < this->temporaryModels.length(); s++) {
-					currentLight->renderModelShadow(this->temporaryShadowMap, this->temporaryModels[s], ortho.view[this->cameraIndex].normalToWorldSpace);
-				}
-				debugText("Cast point-light shadows: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+				shadowCount++;
+				FMatrix3x3 normalToWorld = ortho.view[this->cameraIndex].normalToWorldSpace;
+				graph.addTask([this, currentLight, shadowMap, normalToWorld]() {
+					double startTime = time_getSeconds();
+					shadowMap->clear();
+					// The six sides write to separate depth images, so they can be rendered as independent tasks
+					TaskGroup shadowSides;
+					for (int side = 0; side < 6; side++) {
+						shadowSides.run([this, currentLight, shadowMap, side, normalToWorld]() {
+							// Shadows from background sprites
+							currentLight->renderPassiveShadows(*shadowMap, side, this->passiveSprites, normalToWorld);
+							currentLight->renderPassiveShadows(*shadowMap, side, this->passiveModels, normalToWorld);
+							// Shadows from temporary sprites
+							for (int s = 0; s < this->temporarySprites.length(); s++) {
+								currentLight->renderSpriteShadow(*shadowMap, side, this->temporarySprites[s], normalToWorld);
+							}
+							// Shadows from temporary models
+							for (int s = 0; s < this->temporaryModels.length(); s++) {
+								currentLight->renderModelShadow(*shadowMap, side, this->temporaryModels[s], normalToWorld);
+							}
+						});
+					}
+					shadowSides.wait();
+					debugText("Cast point-light shadows: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+				}, {}, {shadowResource});
 			}
-			startTime = time_getSeconds();
-			currentLight->illuminate(this->ortho.view[this->cameraIndex], worldCenter, this->lightBuffer, this->normalBuffer, this->heightBuffer, this->temporaryShadowMap);
-			debugText("Illuminate from point-light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+			graph.addTask([this, currentLight, shadowMap, worldCenter]() {
+				double startTime = time_getSeconds();
+				currentLight->illuminate(this->ortho.view[this->cameraIndex], worldCenter, this->lightBuffer, this->normalBuffer, this->heightBuffer, *shadowMap);
+				debugText("Illuminate from point-light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+			}, currentLight->shadowCasting ? List<TaskResource>({normalResource, heightResource, shadowResource}) : List<TaskResource>({normalResource, heightResource}), {lightResource});
 		}
 
 		// Draw the final image to the target by multiplying diffuse with light
-		startTime = time_getSeconds();
-			blendLight(colorTarget, this->diffuseBuffer, this->lightBuffer);
-		debugText("Blend light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+		graph.addTask([this, &colorTarget]() {
+			double startTime = time_getSeconds();
+				blendLight(colorTarget, this->diffuseBuffer, this->lightBuffer);
+			debugText("Blend light: ", (time_getSeconds() - startTime) * 1000.0, " ms\n");
+		}, {diffuseResource, lightResource}, {TaskResource(&colorTarget)});
+
+		graph.execute();
 	}
 };
 
@@ -0,0 +1,128 @@
+﻿
+#include "../testTools.h"
+#include "../../DFPSR/api/timeAPI.h"
+#include "../../DFPSR/base/allocator.h"
+#include <thread>
+#include <vector>
+
+// Allocates and frees objects of mixed sizes while checking that no other thread writes to the same memory
+static bool allocationWorkload(int iterations, uint8_t pattern) {
+	const int slotCount = 64;
+	uint8_t* slots[slotCount] = {};
+	int sizes[slotCount] = {};
+	for (int i = 0; i < iterations; i++) {
+		int s = (i * 7) % slotCount;
+		if (slots[s] != nullptr) {
+			// Only the ends are checked, so that the benchmark measures allocation rather than memory bandwidth
+			if (slots[s][0] != pattern || slots[s][sizes[s] - 1] != pattern) {
+				return false;
+			}
+			delete[] slots[s];
+		}
+		// Sizes from 1 to 3000 bytes cover every size group and some larger allocations
+		sizes[s] = 1 + (i * 37) % 3000;
+		slots[s] = new uint8_t[sizes[s]];
+		slots[s][0] = pattern;
+		slots[s][sizes[s] - 1] = pattern;
+	}
+	for (int s = 0; s < slotCount; s++) {
+		delete[] slots[s];
+	}
+	return true;
+}
+
+// Returns the number of allocations per millisecond when running the workload on threadCount threads at the same time
+static double measureThroughput(int threadCount, int iterationsPerThread, bool& correct) {
+	std::vector<std::thread> threads;
+	std::vector<int> results(threadCount, 0);
+	double startTime = time_getSeconds();
+	for (int t = 0; t < threadCount; t++) {
+		int* result = &results[t];
+		threads.push_back(std::thread([result, iterationsPerThread, t]() {
+			*result = allocationWorkload(iterationsPerThread, (uint8_t)(t + 1)) ? 1 : 0;
+		}));
+	}
+	for (int t = 0; t < threadCount; t++) {
+		threads[t].join();
+	}
+	double totalTime = time_getSeconds() - startTime;
+	correct = true;
+	for (int t = 0; t < threadCount; t++) {
+		if (results[t] == 0) {
+			correct = false;
+		}
+	}
+	return (double)(threadCount * iterationsPerThread) / (totalTime * 1000.0);
+}
+
+START_TEST(Allocator)
+	{ // Freeing memory on another thread than the one that allocated it
+		const int count = 1000;
+		std::vector<int*> allocations;
+		std::thread producer([&allocations]() {
+			for (int i = 0; i < count; i++) {
+				allocations.push_back(new int(i));
+			}
+		});
+		producer.join();
+		std::thread consumer([&allocations]() {
+			for (int i = 0; i < count; i++) {
+				delete allocations[i];
+			}
+		});
+		consumer.join();
+		int* reused = new int(5);
+		ASSERT_EQUAL(*reused, 5);
+		delete reused;
+	}
+	{ // Statistics
+		const int count = 100;
+		// 100 bytes belong to the size group of 128 bytes
+		const int groupIndex = 3;
+		AllocatorStatistics before = allocator_getStatistics();
+		ASSERT(before.available);
+		ASSERT_EQUAL(before.sizeGroups[groupIndex].allocationSize, 128);
+		uint8_t* allocations[count];
+		for (int i = 0; i < count; i++) {
+			allocations[i] = new uint8_t[100];
+		}
+		AllocatorStatistics during = allocator_getStatistics();
+		ASSERT_EQUAL(during.sizeGroups[groupIndex].liveCount, before.sizeGroups[groupIndex].liveCount + count);
+		ASSERT_GREATER_OR_EQUAL(during.liveBytes, before.liveBytes + count * 128);
+		ASSERT_EQUAL(during.reservedBytes, during.liveBytes + during.pooledBytes);
+		ASSERT_GREATER_OR_EQUAL(during.peakReservedBytes, during.reservedBytes);
+		for (int i = 0; i < count; i++) {
+			delete[] allocations[i];
+		}
+		AllocatorStatistics after = allocator_getStatistics();
+		ASSERT_EQUAL(after.sizeGroups[groupIndex].liveCount, before.sizeGroups[groupIndex].liveCount);
+		ASSERT_GREATER_OR_EQUAL(after.sizeGroups[groupIndex].pooledCount, count);
+		// Allocating again reuses the pooled memory
+		for (int i = 0; i < count; i++) {
+			allocations[i] = new uint8_t[100];
+		}
+		AllocatorStatistics reused = allocator_getStatistics();
+		ASSERT_EQUAL(reused.sizeGroups[groupIndex].missCount, after.sizeGroups[groupIndex].missCount);
+		ASSERT_GREATER_OR_EQUAL(reused.sizeGroups[groupIndex].hitCount, after.sizeGroups[groupIndex].hitCount + count);
+		for (int i = 0; i < count; i++) {
+			delete[] allocations[i];
+		}
+		// Large allocations are counted separately
+		//   The pointer is volatile to prevent optimizing away the allocation in release mode
+		uint8_t* volatile large = new uint8_t[100000];
+		ASSERT_EQUAL(allocator_getStatistics().largeLiveCount, before.largeLiveCount + 1);
+		delete[] large;
+		ASSERT_EQUAL(allocator_getStatistics().largeLiveCount, before.largeLiveCount);
+	}
+	{ // Benchmark comparing allocation throughput with one and multiple threads
+		const int iterations = 200000;
+		int threadCount = std::max(4, (int)std::thread::hardware_concurrency());
+		bool correct;
+		double singleThroughput = measureThroughput(1, iterations, correct);
+		ASSERT(correct);
+		double multiThroughput = measureThroughput(threadCount, iterations, correct);
+		ASSERT(correct);
+		printText("\nAllocations per millisecond using 1 thread: ", singleThroughput, "\n");
+		printText("Allocations per millisecond using ", threadCount, " threads: ", multiThroughput, "\n");
+	}
+END_TEST
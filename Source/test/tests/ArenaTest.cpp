@@ -0,0 +1,61 @@
+﻿
+#include "../testTools.h"
+#include "../../DFPSR/base/Arena.h"
+#include <thread>
+
+START_TEST(Arena)
+	{ // Allocations are aligned and do not overlap
+		Arena arena(256);
+		uint8_t *a = (uint8_t*)arena.allocate(3, 1);
+		uint8_t *b = (uint8_t*)arena.allocate(100, 16);
+		uint8_t *c = (uint8_t*)arena.allocate(8, 64);
+		ASSERT_EQUAL((uintptr_t)b % 16, (uintptr_t)0);
+		ASSERT_EQUAL((uintptr_t)c % 64, (uintptr_t)0);
+		ASSERT(b >= a + 3);
+		ASSERT(c >= b + 100 || c + 8 <= b);
+	}
+	{ // Rewinding reuses the same memory without asking the system for more
+		Arena arena(1024);
+		Arena::Marker start = arena.getMarker();
+		void *first = arena.allocate(500);
+		arena.allocate(5000); // Larger than the first block
+		uintptr_t reserved = arena.getReservedBytes();
+		arena.rewind(start);
+		ASSERT(arena.allocate(500) == first);
+		arena.allocate(5000);
+		ASSERT_EQUAL(arena.getReservedBytes(), reserved);
+		// Simulate many frames of the same size
+		for (int frame = 0; frame < 100; frame++) {
+			arena.reset();
+			for (int i = 0; i < 10; i++) {
+				arena.allocate(500);
+			}
+		}
+		ASSERT_EQUAL(arena.getReservedBytes(), reserved);
+	}
+	{ // Scoped arrays are released in the opposite order of creation
+		Arena &arena = arena_getThreadLocal();
+		Arena::Marker before = arena.getMarker();
+		{
+			ArenaArray<int32_t> outer(1000);
+			for (int i = 0; i < outer.length(); i++) {
+				outer[i] = i;
+			}
+			{
+				// Too large for a variable length array on the stack
+				ArenaArray<int64_t> inner(1000000);
+				inner[999999] = 7;
+				ASSERT_EQUAL(inner[999999], (int64_t)7);
+			}
+			ASSERT_EQUAL(outer[999], 999);
+		}
+		Arena::Marker after = arena.getMarker();
+		ASSERT(after.block == before.block && after.offset == before.offset);
+	}
+	{ // Each thread has its own arena
+		Arena *mainArena = &arena_getThreadLocal();
+		Arena *otherArena = nullptr;
+		std::thread([&otherArena]() { otherArena = &arena_getThreadLocal(); }).join();
+		ASSERT(mainArena != otherArena);
+	}
+END_TEST
@@ -25,4 +25,36 @@ START_TEST(Buffer)
 		ASSERT_EQUAL(buffer_getUseCount(e), 2);
 		ASSERT_EQUAL(buffer_getUseCount(f), 1);
 	}
+	{ // Alignment and reuse of large buffers
+		BufferAllocationPolicy oldPolicy = buffer_getAllocationPolicy();
+		BufferAllocationPolicy policy;
+		policy.poolThreshold = 65536;
+		policy.poolLimit = 1048576;
+		policy.hugePageThreshold = 0;
+		buffer_setAllocationPolicy(policy);
+		buffer_releasePool();
+		Buffer medium = buffer_create(2000);
+		ASSERT_EQUAL((uintptr_t)buffer_dangerous_getUnsafeData(medium) % 64, (uintptr_t)0);
+		Buffer large = buffer_create(100000);
+		uint8_t *largeData = buffer_dangerous_getUnsafeData(large);
+		ASSERT_EQUAL((uintptr_t)largeData % 4096, (uintptr_t)0);
+		buffer_setBytes(large, 255);
+		ASSERT_EQUAL(buffer_getPooledBytes(), 0);
+		large = Buffer();
+		ASSERT_EQUAL(buffer_getPooledBytes(), 102400); // Rounded up to whole pages
+		// A buffer of the same size in whole pages reuses the memory, but is still cleared
+		Buffer reused = buffer_create(99999);
+		ASSERT(buffer_dangerous_getUnsafeData(reused) == largeData);
+		ASSERT_EQUAL(buffer_getPooledBytes(), 0);
+		ASSERT_EQUAL(buffer_dangerous_getUnsafeData(reused)[0], 0);
+		ASSERT_EQUAL(buffer_dangerous_getUnsafeData(reused)[99998], 0);
+		// Releasing more than the limit frees the oldest allocations
+		reused = Buffer();
+		Buffer huge = buffer_create(1000000);
+		huge = Buffer();
+		ASSERT_EQUAL(buffer_getPooledBytes(), 1003520);
+		buffer_releasePool();
+		ASSERT_EQUAL(buffer_getPooledBytes(), 0);
+		buffer_setAllocationPolicy(oldPolicy);
+	}
 END_TEST
@@ -150,6 +150,23 @@ START_TEST(File)
 		ASSERT_EQUAL(string_save(filePathC, U"Test", CharacterEncoding::Raw_Latin1), true);
 		ASSERT_MATCH(string_load(filePathC, false), U"Test");
 		ASSERT_EQUAL(file_getFileSize(filePathC), 4);
+		// Map the file into memory instead of copying it.
+		{
+			Buffer mapped = file_mapBuffer(filePathC);
+			ASSERT_EQUAL(buffer_getSize(mapped), 4);
+			SafePointer<uint8_t> mappedData = buffer_getSafeData<uint8_t>(mapped, "mapped file");
+			ASSERT_EQUAL(mappedData[0], (uint8_t)'T');
+			ASSERT_EQUAL(mappedData[3], (uint8_t)'t');
+			// Writing to the mapped buffer should not modify the file.
+			mappedData[0] = (uint8_t)'B';
+			ASSERT_EQUAL(mappedData[0], (uint8_t)'B');
+			ASSERT_MATCH(string_load(filePathC, false), U"Test");
+		}
+		ASSERT_EQUAL(buffer_exists(file_mapBuffer(U"FooBarParent/NotFound.txt", false)), false);
+		ASSERT_EQUAL(string_save(filePathC, U"", CharacterEncoding::Raw_Latin1), true);
+		ASSERT_EQUAL(buffer_exists(file_mapBuffer(filePathC)), true);
+		ASSERT_EQUAL(buffer_getSize(file_mapBuffer(filePathC)), 0);
+		ASSERT_EQUAL(string_save(filePathC, U"Test", CharacterEncoding::Raw_Latin1), true);
 		ASSERT_EQUAL(file_removeEmptyFolder(childPathA), false); // Trying to remove FooBarParent/FooBarChildA now should fail.
 		// Remove the file.
 		ASSERT_EQUAL(file_removeFile(filePathC), true);
@@ -2,6 +2,7 @@
 #include "../testTools.h"
 #include "../../DFPSR/base/threading.h"
 #include "../../DFPSR/api/timeAPI.h"
+#include <thread>
 
 // The dummy tasks are too small to get a benefit from multi-threading. (0.18 ms overhead on 0.04 ms of total work)
 START_TEST(Thread)
@@ -49,5 +50,199 @@ START_TEST(Thread)
 			ASSERT_EQUAL(items[i], 0);
 		}
 	}
+	{ // Repeated batches reusing the same parked worker threads
+		const int jobCount = 16;
+		int results[jobCount] = {};
+		for (int batch = 0; batch < 100; batch++) {
+			std::function<void()> jobs[jobCount];
+			for (int i = 0; i < jobCount; i++) {
+				int* result = &results[i];
+				jobs[i] = [result, i]() {
+					*result += i;
+				};
+			}
+			threadedWorkFromArray(jobs, jobCount);
+		}
+		for (int i = 0; i < jobCount; i++) {
+			ASSERT_EQUAL(results[i], i * 100);
+		}
+	}
+	{ // Adaptive split with uneven workloads, where every index must be visited exactly once
+		List<int> items;
+		for (int i = 0; i < 1000; i++) {
+			items.push(0);
+		}
+		int* itemPtr = &items[0];
+		threadedSplit_adaptive(100, 900, [itemPtr](int startIndex, int stopIndex) {
+			for (int i = startIndex; i < stopIndex; i++) {
+				// Make the first part of the interval much heavier
+				if (i < 200) {
+					time_sleepSeconds(0.0001f);
+				}
+				itemPtr[i] += i;
+			}
+		}, 7);
+		for (int i = 0; i < items.length(); i++) {
+			ASSERT_EQUAL(items[i], (i >= 100 && i < 900) ? i : 0);
+		}
+	}
+	{ // Nested parallel work from inside of tasks in a task group
+		const int outerCount = 6;
+		const int innerCount = 200;
+		int results[outerCount][innerCount] = {};
+		TaskGroup group;
+		for (int o = 0; o < outerCount; o++) {
+			int* resultRow = results[o];
+			group.run([resultRow, o]() {
+				threadedSplit(0, innerCount, [resultRow, o](int startIndex, int stopIndex) {
+					for (int i = startIndex; i < stopIndex; i++) {
+						resultRow[i] = o * 1000 + i;
+					}
+				}, 10);
+			});
+		}
+		group.wait();
+		for (int o = 0; o < outerCount; o++) {
+			for (int i = 0; i < innerCount; i++) {
+				ASSERT_EQUAL(results[o][i], o * 1000 + i);
+			}
+		}
+	}
+	{ // Independent threads submitting parallel work at the same time
+		const int jobCount = 300;
+		int resultsA[jobCount] = {};
+		int resultsB[jobCount] = {};
+		int* resultPtrA = resultsA;
+		int* resultPtrB = resultsB;
+		std::thread otherSubmitter([resultPtrA]() {
+			threadedSplit_adaptive(0, jobCount, [resultPtrA](int startIndex, int stopIndex) {
+				for (int i = startIndex; i < stopIndex; i++) {
+					resultPtrA[i] = i + 1;
+				}
+			}, 3);
+		});
+		threadedSplit_adaptive(0, jobCount, [resultPtrB](int startIndex, int stopIndex) {
+			for (int i = startIndex; i < stopIndex; i++) {
+				resultPtrB[i] = i + 2;
+			}
+		}, 3);
+		otherSubmitter.join();
+		for (int i = 0; i < jobCount; i++) {
+			ASSERT_EQUAL(resultsA[i], i + 1);
+			ASSERT_EQUAL(resultsB[i], i + 2);
+		}
+	}
+	{ // Task graph with dependencies found from overlapping resources
+		std::atomic<int> clock{0};
+		int startTimes[6] = {};
+		int stopTimes[6] = {};
+		int* starts = startTimes;
+		int* stops = stopTimes;
+		int imageA = 0, imageB = 0, imageC = 0; // Only used as identities
+		TaskGraph graph;
+		auto stage = [&clock, starts, stops](int index) {
+			return [&clock, starts, stops, index]() {
+				starts[index] = clock++;
+				time_sleepSeconds(0.001f);
+				stops[index] = clock++;
+			};
+		};
+		// 0 and 1 write to different halves of the same image
+		graph.addTask(stage(0), {}, {TaskResource(&imageA, IRect(0, 0, 100, 50))});
+		graph.addTask(stage(1), {}, {TaskResource(&imageA, IRect(0, 50, 100, 50))});
+		// 2 writes to another image
+		graph.addTask(stage(2), {}, {TaskResource(&imageB)});
+		// 3 reads from the upper half of imageA and writes to imageC
+		graph.addTask(stage(3), {TaskResource(&imageA, IRect(0, 0, 100, 50))}, {TaskResource(&imageC)});
+		// 4 reads both images
+		graph.addTask(stage(4), {TaskResource(&imageA), TaskResource(&imageB)}, {});
+		// 5 overwrites imageB after 4 has read it, and waits for 3 explicitly
+		int lastTask = graph.addTask(stage(5), {}, {TaskResource(&imageB)});
+		graph.addDependency(3, lastTask);
+		ASSERT_EQUAL(graph.getTaskCount(), 6);
+		graph.execute();
+		ASSERT_EQUAL(graph.getTaskCount(), 0);
+		ASSERT_EQUAL(clock.load(), 12);
+		ASSERT_GREATER(startTimes[3], stopTimes[0]);
+		ASSERT_GREATER(startTimes[4], stopTimes[0]);
+		ASSERT_GREATER(startTimes[4], stopTimes[1]);
+		ASSERT_GREATER(startTimes[4], stopTimes[2]);
+		ASSERT_GREATER(startTimes[5], stopTimes[2]);
+		ASSERT_GREATER(startTimes[5], stopTimes[3]);
+		ASSERT_GREATER(startTimes[5], stopTimes[4]);
+	}
+	{ // Parallel reduction with partial results per job
+		const int length = 100000;
+		List<int32_t> values;
+		values.reserve(length);
+		for (int i = 0; i < length; i++) {
+			values.push((i * 7919) % 1000 - 500);
+		}
+		int64_t expectedSum = 0;
+		int32_t expectedMax = -1000000;
+		for (int i = 0; i < length; i++) {
+			expectedSum += values[i];
+			if (values[i] > expectedMax) expectedMax = values[i];
+		}
+		int64_t sum = threadedReduce<int64_t>(0, length, 0, [&values](int startIndex, int stopIndex) {
+			int64_t partialSum = 0;
+			for (int i = startIndex; i < stopIndex; i++) {
+				partialSum += values[i];
+			}
+			return partialSum;
+		}, [](int64_t a, int64_t b) { return a + b; }, 16);
+		ASSERT_EQUAL(sum, expectedSum);
+		int32_t maximum = threadedReduce<int32_t>(0, length, -1000000, [&values](int startIndex, int stopIndex) {
+			int32_t partialMax = -1000000;
+			for (int i = startIndex; i < stopIndex; i++) {
+				if (values[i] > partialMax) partialMax = values[i];
+			}
+			return partialMax;
+		}, [](int32_t a, int32_t b) { return a > b ? a : b; });
+		ASSERT_EQUAL(maximum, expectedMax);
+		// Empty and tiny intervals return the identity or run on the calling thread
+		ASSERT_EQUAL(threadedReduce<int>(5, 5, 42, [](int, int) { return 1; }, [](int a, int b) { return a + b; }), 42);
+		ASSERT_EQUAL(threadedReduce<int>(0, 3, 0, [](int startIndex, int stopIndex) { return stopIndex - startIndex; }, [](int a, int b) { return a + b; }), 3);
+		// Combining in the order of the interval, so that non-commutative reductions also work
+		String order = threadedReduce<String>(0, 26, U"", [](int startIndex, int stopIndex) {
+			String letters;
+			for (int i = startIndex; i < stopIndex; i++) {
+				string_appendChar(letters, U'a' + i);
+			}
+			return letters;
+		}, [](const String& a, const String& b) { return a + b; }, 1);
+		ASSERT_MATCH(order, U"abcdefghijklmnopqrstuvwxyz");
+		// Boolean any and all reductions, which need one element per partial result
+		bool anyAboveLimit = threadedReduce<bool>(0, length, false, [&values, expectedMax](int startIndex, int stopIndex) {
+			for (int i = startIndex; i < stopIndex; i++) {
+				if (values[i] > expectedMax) return true;
+			}
+			return false;
+		}, [](bool a, bool b) { return a || b; }, 16);
+		bool allBelowLimit = threadedReduce<bool>(0, length, true, [&values, expectedMax](int startIndex, int stopIndex) {
+			for (int i = startIndex; i < stopIndex; i++) {
+				if (values[i] > expectedMax) return false;
+			}
+			return true;
+		}, [](bool a, bool b) { return a && b; }, 16);
+		ASSERT(!anyAboveLimit);
+		ASSERT(allBelowLimit);
+	}
+	{ // Parallel reduction over rows in a rectangle
+		IRect bound = IRect(3, 10, 20, 500);
+		int64_t pixelCount = threadedReduce<int64_t>(bound, 0, [](const IRect& subBound) {
+			return (int64_t)subBound.width() * subBound.height();
+		}, [](int64_t a, int64_t b) { return a + b; }, 8);
+		ASSERT_EQUAL(pixelCount, (int64_t)20 * 500);
+		IRect covered = threadedReduce<IRect>(bound, IRect(), [bound](const IRect& subBound) {
+			return subBound;
+		}, [](const IRect& a, const IRect& b) {
+			return a.hasArea() ? IRect::merge(a, b) : b;
+		}, 8);
+		ASSERT_EQUAL(covered.left(), bound.left());
+		ASSERT_EQUAL(covered.top(), bound.top());
+		ASSERT_EQUAL(covered.right(), bound.right());
+		ASSERT_EQUAL(covered.bottom(), bound.bottom());
+	}
 END_TEST
 